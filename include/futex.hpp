@@ -0,0 +1,73 @@
+/**
+ * @file futex.hpp
+ * @author Eden Kellner
+ * @date 26/08/2026
+ *
+ * @brief Thin inline wrappers around the Linux futex(2) system call.
+ * These are internal building blocks used by the synchronisation primitives
+ * in this library (e.g. EK::Semaphore) to block and wake threads directly
+ * on an atomic word, without going through a mutex.
+ */
+
+#pragma once
+
+#include <atomic>        // std::atomic
+#include <cstdint>       // int32_t
+#include <ctime>         // struct timespec
+#include <linux/futex.h> // FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <sys/syscall.h> // SYS_futex
+#include <unistd.h>      // syscall
+
+namespace EK {
+namespace detail {
+
+  /**
+   * @brief Block the calling thread as long as *addr == expected.
+   * Returns immediately if the value differs when the kernel examines it.
+   *
+   * @param addr The atomic word to wait on.
+   * @param expected The value *addr must hold for the thread to be put to sleep.
+   * @param timeout Optional relative timeout. nullptr means wait indefinitely.
+   *
+   * @return 0 when woken, -1 on error (errno is set, e.g. ETIMEDOUT or EAGAIN).
+   */
+  inline long FutexWait(std::atomic<int32_t>* addr, int32_t expected,
+      const struct timespec* timeout = nullptr) {
+    return syscall(SYS_futex, reinterpret_cast<int32_t*>(addr),
+        FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+  }
+
+  /**
+   * @brief Block the calling thread as long as *addr == expected, with an
+   * absolute CLOCK_MONOTONIC deadline. Unlike the relative timeout of
+   * FutexWait(), re-arming after a spurious wake-up keeps the original
+   * deadline instead of restarting the full wait.
+   *
+   * @param addr The atomic word to wait on.
+   * @param expected The value *addr must hold for the thread to be put to sleep.
+   * @param deadline Absolute CLOCK_MONOTONIC time at which to give up.
+   *
+   * @return 0 when woken, -1 on error (errno is set, e.g. ETIMEDOUT or EAGAIN).
+   */
+  inline long FutexWaitUntil(std::atomic<int32_t>* addr, int32_t expected,
+      const struct timespec* deadline) {
+    return syscall(SYS_futex, reinterpret_cast<int32_t*>(addr),
+        FUTEX_WAIT_BITSET_PRIVATE, expected, deadline, nullptr,
+        FUTEX_BITSET_MATCH_ANY);
+  }
+
+  /**
+   * @brief Wake up to count threads blocked in FutexWait() on addr.
+   *
+   * @param addr The atomic word threads are waiting on.
+   * @param count The maximum number of threads to wake.
+   *
+   * @return The number of threads actually woken, or -1 on error.
+   */
+  inline long FutexWake(std::atomic<int32_t>* addr, int32_t count) {
+    return syscall(SYS_futex, reinterpret_cast<int32_t*>(addr),
+        FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+  }
+
+} // end namespace detail
+} // end namespace EK
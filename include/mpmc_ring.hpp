@@ -0,0 +1,229 @@
+/**
+ * @file mpmc_ring.hpp
+ * @author Eden Kellner
+ * @date 26/08/2026
+ *
+ * @brief Bounded, lock-free multi-producer multi-consumer ring buffer,
+ * following Dmitry Vyukov's design: each slot carries a sequence number
+ * which tells producers and consumers whether the slot is theirs to use.
+ * Producers and consumers claim slots with a single compare-and-swap on
+ * a position counter, so concurrent threads only ever serialize on the
+ * specific slot they are touching - there is no mutex and no system call.
+ *
+ * This is the storage engine behind EK::WaitableQueue. The ring itself
+ * never blocks: TryEnqueue()/TryDequeue() simply report failure when the
+ * ring is full or empty, and the caller decides how to wait.
+ */
+
+#pragma once
+
+#include <atomic>  // std::atomic
+#include <cstddef> // size_t
+#include <cstdint> // intptr_t
+#include <memory>  // std::unique_ptr
+#include <thread>  // std::this_thread::yield
+#include <utility> // std::move
+
+namespace EK {
+namespace detail {
+
+  /**
+   * @brief Hint to the CPU that we are in a busy-wait loop.
+   * Reduces pipeline pressure and power draw while spinning.
+   */
+  inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  /**
+   * @brief Bounded spin-then-yield backoff for retry loops.
+   *
+   * Waits that usually resolve within a few iterations (a peer mid-
+   * publish) get the cheap CpuRelax treatment; waits that drag on (a
+   * full ring with no consumer making room, a paused pool) fall back
+   * to yielding the time slice, so a stalled producer cannot pin a
+   * core at 100% indefinitely.
+   */
+  class Backoff {
+    public:
+      void Wait() {
+        if (spins_ < kSpinLimit) {
+          ++spins_;
+          CpuRelax();
+        } else {
+          std::this_thread::yield();
+        }
+      }
+
+    private:
+      // Matches the spin budget of the consumer-side waits (e.g.
+      // WaitableQueue::Dequeue): long enough to ride out a peer's
+      // publish window, short enough that yielding kicks in before the
+      // scheduler would have preempted us anyway.
+      static const int kSpinLimit = 64;
+
+      int spins_ = 0;
+  };
+
+} // end namespace detail
+
+  /**
+   * @brief Bounded lock-free MPMC ring buffer.
+   *
+   * @tparam T is the value type which the ring holds. It must be
+   * default-constructible and move-assignable.
+   */
+  template <class T>
+  class MpmcRing {
+    public:
+      /**
+       * @brief Construct a ring with room for at least capacity elements.
+       * The actual capacity is rounded up to a power of two, so that
+       * positions can be mapped to slots with a mask instead of a modulo.
+       *
+       * @param capacity The minimum number of elements the ring can hold.
+       */
+      explicit MpmcRing(size_t capacity) :
+        cells_(nullptr), mask_(0), enqueue_pos_(0), dequeue_pos_(0) {
+        size_t size = 2;
+        while (size < capacity) {
+          size *= 2;
+        }
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) {
+          cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        mask_ = size - 1;
+      }
+
+      /**
+       * @brief Attempt to insert a new item into the ring.
+       * value is only moved-from when the insertion succeeds.
+       *
+       * @param value - the item we wish to insert.
+       *
+       * @return true if the item was inserted, false if the ring is full.
+       */
+      bool TryEnqueue(T&& value) {
+        Cell* cell;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+        for (;;) {
+          cell = &cells_[pos & mask_];
+          size_t seq = cell->sequence.load(std::memory_order_acquire);
+          intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+          if (0 == diff) {
+            // The slot is free. Claim it by advancing the enqueue position.
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                  std::memory_order_relaxed)) {
+              break;
+            }
+          } else if (diff < 0) {
+            // The slot still holds an unconsumed item - the ring is full.
+            return false;
+          } else {
+            // Another producer claimed this slot; reload and retry.
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+          }
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      /**
+       * @brief Attempt to remove an item from the ring.
+       *
+       * @param outparam used to return the item acquired.
+       *
+       * @return true if an item was acquired, false if the ring is empty.
+       */
+      bool TryDequeue(T& outparam) {
+        Cell* cell;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+        for (;;) {
+          cell = &cells_[pos & mask_];
+          size_t seq = cell->sequence.load(std::memory_order_acquire);
+          intptr_t diff =
+            static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+          if (0 == diff) {
+            // The slot holds a published item. Claim it.
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                  std::memory_order_relaxed)) {
+              break;
+            }
+          } else if (diff < 0) {
+            // The slot has not been published yet - the ring is empty.
+            return false;
+          } else {
+            // Another consumer claimed this slot; reload and retry.
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+          }
+        }
+
+        outparam = std::move(cell->value);
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+      }
+
+      /**
+       * @brief Get an estimate of the number of elements in the ring.
+       * The value is computed from two independently-moving counters, so
+       * it is only exact when no other thread is operating on the ring.
+       *
+       * @return Approximate number of elements in the ring.
+       */
+      size_t ApproxSize() const {
+        size_t enqueue_pos = enqueue_pos_.load(std::memory_order_acquire);
+        size_t dequeue_pos = dequeue_pos_.load(std::memory_order_acquire);
+        return (enqueue_pos > dequeue_pos) ? (enqueue_pos - dequeue_pos) : 0;
+      }
+
+      /**
+       * @brief Get the number of elements the ring can hold.
+       *
+       * @return The ring's (power-of-two) capacity.
+       */
+      size_t Capacity() const {
+        return mask_ + 1;
+      }
+
+      // Uncopyable
+      MpmcRing(const MpmcRing&) = delete;
+      MpmcRing& operator=(const MpmcRing&) = delete;
+
+      // Default dtor is sufficient.
+      ~MpmcRing() = default;
+
+    private:
+      // Assumed cache line size. Padding members (rather than alignas)
+      // keep the ring heap-allocatable under C++14, where operator new
+      // ignores extended alignment.
+      static const size_t kCacheLineSize = 64;
+
+      struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+      };
+
+      std::unique_ptr<Cell[]> cells_;
+      size_t mask_;
+
+      // Producers hammer enqueue_pos_ and consumers hammer dequeue_pos_;
+      // a cache line of padding on each side stops one group's CAS loop
+      // from invalidating the line the other group is spinning on.
+      char pad0_[kCacheLineSize];
+      std::atomic<size_t> enqueue_pos_;
+      char pad1_[kCacheLineSize];
+      std::atomic<size_t> dequeue_pos_;
+      char pad2_[kCacheLineSize];
+    };
+} // end namespace EK
@@ -1,35 +1,39 @@
 /**
- * @file semaphore.hpp 
+ * @file semaphore.hpp
  * @author Eden Kellner
  * @date 01/05/2023
  *
- * @brief C++11-compatible semaphore implementation.
+ * @brief Futex-based semaphore implementation.
  * Semaphore is a signalling device, used for synchronisation between
- * threads, as it restricts access to critical code sections until a signal 
+ * threads, as it restricts access to critical code sections until a signal
  * is received.
  * Each semaphore has a counter. When a thread reached a semaphore, it checks its counter.
  * 1. If the counter is positive, it decrements it and passes.
- * 2. If the counter is zero, the thread will be blocked until the semaphore is 
+ * 2. If the counter is zero, the thread will be blocked until the semaphore is
  *    incremented by another thread.
+ *
+ * The counter is a single atomic word: an uncontended Acquire() or Release()
+ * is one lock-free compare-and-swap with no system call. Threads only enter
+ * the kernel (via the Linux futex interface) when they actually have to block.
  */
 
-#pragma once 
+#pragma once
 
-#include <chrono>             // std::chrono::milliseconds
-#include <mutex>              // std::mutex
-#include <condition_variable> // std::condition_variable
+#include <atomic>             // std::atomic
+#include <chrono>             // std::chrono::milliseconds, std::chrono::steady_clock
+#include <cstdint>            // int32_t
 
 namespace EK {
 
   /**
-   * @brief C++11-compatible semaphore.
+   * @brief Futex-based counting semaphore.
    */
   class Semaphore {
     public:
       /**
        * @brief Construct a sempahore.
        *
-       * @param initial_count The value the semaphore's counter 
+       * @param initial_count The value the semaphore's counter
        * should be initialised with.
        */
       explicit Semaphore(size_t initial_count = 0);
@@ -37,7 +41,7 @@ namespace EK {
       /**
        * @brief Increment the counter and signal waiting threads.
        */
-      void Release();
+      __attribute__((hot)) void Release();
 
       /**
        * @brief Increase the counter by a specific value, and signal waiting threads.
@@ -50,11 +54,19 @@ namespace EK {
        * @brief If the counter is positive, decrement it and pass.
        * Otherwise, wait until the sempahore is released by another thread.
        */
-      void Acquire();
+      __attribute__((hot)) void Acquire();
 
       /**
        * @brief If the counter is positive, decrement it and pass.
-       * Otherwise, wait until the semaphore is released by another thread 
+       * Never blocks.
+       *
+       * @return true if the counter was decremented, false if it was 0.
+       */
+      bool TryAcquire();
+
+      /**
+       * @brief If the counter is positive, decrement it and pass.
+       * Otherwise, wait until the semaphore is released by another thread
        * or until timeout duration has been exceeded.
        *
        * @param timeout The maximum duration a thread will wait on the semaphore.
@@ -63,6 +75,22 @@ namespace EK {
        */
       bool TryAcquireFor(std::chrono::milliseconds timeout);
 
+      /**
+       * @brief If the counter is positive, decrement it and pass.
+       * Otherwise, wait until the semaphore is released by another thread
+       * or until the given point in time.
+       *
+       * Callers that retry several timed waits against one deadline
+       * should prefer this over TryAcquireFor, which measures its
+       * timeout from the moment of each call.
+       *
+       * @param deadline The point in time at which to give up waiting.
+       *
+       * @return true if decremented the counter, otherwise, if the
+       * deadline passed, false.
+       */
+      bool TryAcquireUntil(std::chrono::steady_clock::time_point deadline);
+
       /**
        * @brief Get current counter value
        *
@@ -74,7 +102,7 @@ namespace EK {
       Semaphore(const Semaphore&) = delete;
       Semaphore& operator=(const Semaphore&) = delete;
 
-      // Unmovable (because of std::mutex)
+      // Unmovable (because of std::atomic)
       Semaphore(Semaphore&&) = delete;
       Semaphore& operator=(Semaphore&&) = delete;
 
@@ -82,8 +110,11 @@ namespace EK {
       ~Semaphore() = default;
 
     private:
-      std::mutex mutex_;
-      std::condition_variable cv_;
-      size_t counter_;
+      std::atomic<int32_t> counter_;
+
+      // Number of threads currently blocked in the kernel. Lets Release()
+      // skip the FUTEX_WAKE system call when nobody is sleeping, which is
+      // the common case under steady throughput.
+      std::atomic<int32_t> waiters_;
     };
 } // end namespace EK
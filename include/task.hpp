@@ -0,0 +1,208 @@
+/**
+ * @file task.hpp
+ * @author Eden Kellner
+ * @date 26/08/2026
+ *
+ * @brief Move-only, type-erased callable with small-buffer optimisation,
+ * used by EK::ThreadPool to store submitted tasks.
+ *
+ * std::function heap-allocates its target for all but the tiniest captures,
+ * which makes every submitted task cost a malloc/free pair. Task instead
+ * keeps callables of up to kInlineCapacity bytes inside its own storage -
+ * they live directly in the task queue's slots, with no allocation at all -
+ * and only falls back to the heap for oversized captures. Unlike
+ * std::function, Task also accepts move-only callables.
+ */
+
+#pragma once
+
+#include <cstddef>     // size_t, std::max_align_t
+#include <type_traits> // std::aligned_storage, std::enable_if, std::decay
+#include <utility>     // std::forward, std::move
+
+namespace EK {
+namespace detail {
+
+  // The per-callable-type operations a Task needs: one instance of this
+  // table exists per callable type F, shared by every Task holding an F.
+  struct TaskOps {
+    void (*invoke)(void* callable);
+    void (*move)(void* from, void* to);
+    void (*destroy)(void* callable);
+    bool is_inline;
+  };
+
+  // Operations for callables stored inside the task's inline buffer.
+  template <class F>
+  struct InlineTaskOps {
+    static void Invoke(void* callable) {
+      (*static_cast<F*>(callable))();
+    }
+
+    static void Move(void* from, void* to) {
+      F* source = static_cast<F*>(from);
+      new (to) F(std::move(*source));
+      source->~F();
+    }
+
+    static void Destroy(void* callable) {
+      static_cast<F*>(callable)->~F();
+    }
+
+    static const TaskOps kOps;
+  };
+
+  template <class F>
+  const TaskOps InlineTaskOps<F>::kOps = {
+    &InlineTaskOps<F>::Invoke,
+    &InlineTaskOps<F>::Move,
+    &InlineTaskOps<F>::Destroy,
+    true
+  };
+
+  // Operations for oversized callables, which live on the heap. Moving a
+  // heap-held callable is just a pointer handover, so no move op is needed.
+  template <class F>
+  struct HeapTaskOps {
+    static void Invoke(void* callable) {
+      (*static_cast<F*>(callable))();
+    }
+
+    static void Destroy(void* callable) {
+      delete static_cast<F*>(callable);
+    }
+
+    static const TaskOps kOps;
+  };
+
+  template <class F>
+  const TaskOps HeapTaskOps<F>::kOps = {
+    &HeapTaskOps<F>::Invoke,
+    nullptr,
+    &HeapTaskOps<F>::Destroy,
+    false
+  };
+
+} // end namespace detail
+
+  /**
+   * @brief Move-only type-erased callable taking no arguments and
+   * returning nothing.
+   */
+  class Task {
+    public:
+      /// Callables up to this size (in bytes) are stored inline.
+      static const size_t kInlineCapacity = 48;
+
+      /**
+       * @brief Construct an empty task. Invoking it is undefined;
+       * empty tasks exist so that queue slots can be default-constructed.
+       */
+      Task() noexcept : ops_(nullptr), storage_() {}
+
+      /**
+       * @brief Construct a task holding any callable invokable as f().
+       * Small callables are placed in the task's inline buffer; larger
+       * ones are allocated on the heap.
+       *
+       * @param f The callable the task should hold.
+       */
+      template <class F,
+        class = typename std::enable_if<
+          !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+      Task(F&& f) : ops_(nullptr), storage_() {
+        using Fn = typename std::decay<F>::type;
+        Construct<Fn>(std::forward<F>(f),
+            std::integral_constant<bool, FitsInline<Fn>::value>());
+      }
+
+      Task(Task&& other) noexcept : ops_(other.ops_), storage_() {
+        TakeFrom(other);
+      }
+
+      Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+          Reset();
+          ops_ = other.ops_;
+          TakeFrom(other);
+        }
+        return *this;
+      }
+
+      ~Task() {
+        Reset();
+      }
+
+      /**
+       * @brief Invoke the stored callable.
+       */
+      void operator()() {
+        ops_->invoke(Get());
+      }
+
+      /**
+       * @brief Indicates whether the task holds a callable.
+       */
+      explicit operator bool() const noexcept {
+        return nullptr != ops_;
+      }
+
+      // Uncopyable
+      Task(const Task&) = delete;
+      Task& operator=(const Task&) = delete;
+
+    private:
+      template <class Fn>
+      struct FitsInline {
+        static const bool value =
+          sizeof(Fn) <= kInlineCapacity &&
+          alignof(Fn) <= alignof(std::max_align_t);
+      };
+
+      template <class Fn, class F>
+      void Construct(F&& f, std::true_type /* is_inline */) {
+        new (&storage_.buffer) Fn(std::forward<F>(f));
+        ops_ = &detail::InlineTaskOps<Fn>::kOps;
+      }
+
+      template <class Fn, class F>
+      void Construct(F&& f, std::false_type /* is_inline */) {
+        storage_.heap = new Fn(std::forward<F>(f));
+        ops_ = &detail::HeapTaskOps<Fn>::kOps;
+      }
+
+      void* Get() {
+        return ops_->is_inline ? static_cast<void*>(&storage_.buffer)
+                               : storage_.heap;
+      }
+
+      void TakeFrom(Task& other) {
+        if (nullptr != ops_) {
+          if (ops_->is_inline) {
+            ops_->move(&other.storage_.buffer, &storage_.buffer);
+          } else {
+            storage_.heap = other.storage_.heap;
+          }
+          other.ops_ = nullptr;
+        }
+      }
+
+      void Reset() {
+        if (nullptr != ops_) {
+          ops_->destroy(Get());
+          ops_ = nullptr;
+        }
+      }
+
+      union Storage {
+        Storage() : heap(nullptr) {}
+
+        void* heap;
+        typename std::aligned_storage<kInlineCapacity,
+          alignof(std::max_align_t)>::type buffer;
+      };
+
+      const detail::TaskOps* ops_;
+      Storage storage_;
+    };
+} // end namespace EK
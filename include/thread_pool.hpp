@@ -1,5 +1,5 @@
 /**
- * @file thread_pool.hpp 
+ * @file thread_pool.hpp
  * @author Eden Kellner
  * @date 29/04/2023
  *
@@ -7,7 +7,7 @@
  * for distributing tasks among a group of worker threads.
  * It is used to simplify performing tasks concurrently.
  *
- * By providing a dedicated object for multithreaded operations, 
+ * By providing a dedicated object for multithreaded operations,
  * it reduces the overhead cost of creating and destroying threads.
  * It also alleviates the headache of managing synchronization between threads.
  *
@@ -19,30 +19,60 @@
 
 #pragma once
 
-#include "waitable_queue.hpp" // EK::WaitableQueue
-#include "semaphore.hpp"      // EK::Semaphore
-                              
+#include "mpmc_ring.hpp" // EK::MpmcRing
+#include "semaphore.hpp" // EK::Semaphore
+#include "task.hpp"      // EK::Task
+
+#include <atomic>             // std::atomic
 #include <condition_variable> // std::condition_variable
 #include <exception>          // std::current_exception
+#include <memory>             // std::unique_ptr, std::shared_ptr
 #include <thread>             // std::thread
 #include <cstddef>            // size_t
 #include <future>             // std::future
-#include <unordered_map>      // std::unordered_map
-#include <functional>         // std::bind
+#include <tuple>              // std::tuple, std::get
 #include <type_traits>        // std::result_of
-#include <utility>            // std::forward
+#include <utility>            // std::forward, std::index_sequence
+#include <vector>             // std::vector
 
 namespace EK {
+  /**
+   * @brief Scheduling priority for submitted tasks. High-priority tasks
+   * are picked up by workers before any queued normal-priority work.
+   */
+  enum class Priority { kNormal, kHigh };
+
+  namespace detail {
+    // C++14 stand-in for C++17's std::apply: invoke f with the elements
+    // of tuple t as arguments.
+    template <class F, class Tuple, size_t... Is>
+    auto ApplyImpl(F&& f, Tuple&& t, std::index_sequence<Is...>) {
+      return std::forward<F>(f)(std::get<Is>(std::forward<Tuple>(t))...);
+    }
+
+    template <class F, class Tuple>
+    auto Apply(F&& f, Tuple&& t) {
+      using Indices = std::make_index_sequence<
+        std::tuple_size<typename std::decay<Tuple>::type>::value>;
+      return ApplyImpl(std::forward<F>(f), std::forward<Tuple>(t), Indices());
+    }
+  } // end namespace detail
+
   class ThreadPool {
     public:
       /**
        * @brief Constructs a new thread pool. By default the number of threads
        * created is the total number of hardware threads avaiable.
        *
-       * @param thread_count determines how many worker threads will be 
+       * @param thread_count determines how many worker threads will be
        * created initially.
+       * @param pin_threads when true, each worker is pinned to a hardware
+       * thread in round-robin order. Pinning keeps a worker's cached state
+       * (its task queue in particular) on one core, at the cost of letting
+       * the OS no longer migrate workers away from busy cores. Off by
+       * default.
        */
-      ThreadPool(size_t thread_count = 0);
+      ThreadPool(size_t thread_count = 0, bool pin_threads = false);
 
       /**
        * @brief Destructs the thread pool.
@@ -57,21 +87,103 @@ namespace EK {
        * @tparam F The callable type (e.g. std::function<int()>).
        * @tparam Args The types of the zero or more arguments passed to the function.
        * @param task The callable to submit.
-       * @param args The zero or more arguments passed to task 
+       * @param args The zero or more arguments passed to task
        *
        * @return A future from which the return value of task can be retrieved.
-       * If task has no return value, you would get std::future<void> which can 
+       * If task has no return value, you would get std::future<void> which can
        * be used to wait for the task to finish.
        */
       template <typename F, typename... Args>
-      auto Submit(F&& task, Args&&... args) ->
+      __attribute__((hot)) auto Submit(F&& task, Args&&... args) ->
+        std::future<typename std::result_of<F(Args...)>::type>;
+
+      /**
+       * @brief Submit a task with an explicit priority.
+       *
+       * High-priority tasks go through a dedicated lane that workers
+       * drain before any queued normal work, so a short urgent task is
+       * not stuck behind a long backlog (head-of-line blocking).
+       *
+       * @param priority The scheduling priority for this task.
+       * The remaining parameters are as in Submit above.
+       */
+      template <typename F, typename... Args>
+      auto Submit(Priority priority, F&& task, Args&&... args) ->
         std::future<typename std::result_of<F(Args...)>::type>;
 
       /**
-       * @brief Set the number of threads at runtime. 
+       * @brief Submit a task whose result is not needed, skipping the
+       * future machinery entirely.
+       *
+       * Submit() allocates a shared state and synchronises future
+       * readiness even when the caller discards the returned future.
+       * For fire-and-forget tasks this overload enqueues the callable
+       * directly, with none of that overhead.
+       *
+       * Note: since there is no future to carry it, an exception thrown
+       * by the task propagates out of the worker thread and terminates
+       * the program. Catch inside the task if that matters.
+       *
+       * @tparam F The callable type (e.g. std::function<int()>).
+       * @tparam Args The types of the zero or more arguments passed to the function.
+       * @param task The callable to submit.
+       * @param args The zero or more arguments passed to task
+       */
+      template <typename F, typename... Args>
+      __attribute__((hot)) void SubmitDetached(F&& task, Args&&... args);
+
+      /**
+       * @brief Submit a range of callables in one call.
+       *
+       * The whole batch is published with a single semaphore release,
+       * so producers that already have work in bulk pay the
+       * synchronisation cost once instead of once per task. Like
+       * SubmitDetached, no futures are created.
+       *
+       * @tparam InputIt Iterator whose value type is callable as f().
+       * @param first, last The range of callables to submit.
+       */
+      template <class InputIt>
+      void SubmitBatch(InputIt first, InputIt last);
+
+      /**
+       * @brief Submit n copies of the same callable as one batch.
+       *
+       * Convenience over SubmitBatch for fan-out workloads that repeat
+       * one task: the whole batch is published with a single semaphore
+       * release. Detached like SubmitBatch - no futures are created.
+       *
+       * @tparam F The callable type; must be copyable.
+       * @param n How many copies of the task to submit.
+       * @param task The callable to submit n times.
+       */
+      template <typename F>
+      void SubmitN(size_t n, F&& task);
+
+      /**
+       * @brief Run body(i) for every i in [begin, end), in parallel.
+       *
+       * The range is split into one contiguous chunk per worker and
+       * submitted as a single batch, so a loop of n iterations costs a
+       * handful of task submissions instead of n. Blocks until every
+       * iteration has run.
+       *
+       * Note: must not be called from inside a task of this pool - the
+       * calling worker would block waiting for chunks only it can run.
+       *
+       * @tparam F Callable as body(size_t).
+       * @param begin, end The half-open index range to cover.
+       * @param body The callable invoked once per index. Shared state it
+       * touches must be safe to access from several workers at once.
+       */
+      template <typename F>
+      void ParallelFor(size_t begin, size_t end, F&& body);
+
+      /**
+       * @brief Set the number of threads at runtime.
        * Additional threads can be added, or threads can be removed.
        *
-       * @param num_threads The number of worker threads the thread pool 
+       * @param num_threads The number of worker threads the thread pool
        * should posses.
        */
       void SetNumThreads(std::size_t num_threads);
@@ -79,6 +191,10 @@ namespace EK {
       /**
        * @brief Pauses any additional tasks from executing.
        * Tasks that are currently executed won't be passed.
+       *
+       * @note The task queues are bounded, so while the pool is paused
+       * submissions beyond their capacity block the submitting thread
+       * (yielding, not spinning) until Resume() makes room.
        */
       void Pause();
 
@@ -86,31 +202,148 @@ namespace EK {
        * @brief Resumes task execution after being pauses.
        */
       void Resume();
-      
+
       /**
        * @brief Wait for tasks currently in the thread pool to finish.
        */
       void WaitForTasks();
 
+      /**
+       * @brief Ordinal of the calling worker thread.
+       *
+       * Useful for sharding state per worker (e.g. one counter per
+       * worker instead of a shared one). Ordinals are assigned in
+       * creation order and are not reused.
+       *
+       * @return The calling worker's ordinal, or size_t(-1) when the
+       * calling thread is not a thread pool worker.
+       */
+      static size_t WorkerIndex();
+
       // Uncopyable
       ThreadPool(const ThreadPool&) = delete;
       ThreadPool& operator=(const ThreadPool&) = delete;
 
     private:
-      size_t thread_count_;
-      std::unordered_map<std::thread::id, std::thread> threads_;
-      std::unordered_map<std::thread::id, bool> should_run_;
-      WaitableQueue<std::function<void()>> tasks_;
-      WaitableQueue<std::thread::id> joinable_threads_;
+      static const size_t kGlobalQueueCapacity = 1024;
+      static const size_t kLocalQueueCapacity = 256;
+      static const size_t kUrgentQueueCapacity = 256;
+
+      // How long an idle worker spins for a ticket before parking in the
+      // kernel. When tasks arrive in bursts, the next ticket usually
+      // shows up well within the spin window, saving a sleep/wake
+      // syscall pair per task.
+      static const int kIdleSpinIterations = 256;
+
+      // Assumed cache line size, used to keep independently-written hot
+      // state off each other's lines. Padding members are used rather
+      // than alignas, because over-aligned types cannot reliably be
+      // heap-allocated before C++17.
+      static const size_t kCacheLineSize = 64;
+
+      // Per-worker record. Owned through a unique_ptr so that workers can
+      // hold on to a stable pointer while the vector itself grows and
+      // shrinks at runtime.
+      struct ThreadRec {
+        ThreadRec() :
+          thread(), should_run(true),
+          rng_state((reinterpret_cast<uintptr_t>(this) >> 4) | 1),
+          local_tasks(kLocalQueueCapacity) {}
+
+        std::thread thread;
+        std::atomic<bool> should_run;
+
+        // Owner-only xorshift state used to randomise the steal order,
+        // so idle workers do not all converge on the same victim.
+        // Seeded from the record's address; the |1 keeps it non-zero.
+        size_t rng_state;
+
+        // Keeps the run flag and the queue's hot words on separate cache
+        // lines: stealers hammer local_tasks while only shutdown touches
+        // should_run.
+        char pad[kCacheLineSize];
+
+        // This worker's own task queue. Siblings may steal from it when
+        // their queues and the global queue run dry.
+        MpmcRing<Task> local_tasks;
+      };
+
+      // Set for the duration of ServeTasks, so that a Submit call made
+      // from inside a task can recognise its own pool and push straight
+      // into the calling worker's queue instead of the global one.
+      static thread_local ThreadPool* tls_pool_;
+      static thread_local ThreadRec* tls_rec_;
+      static thread_local size_t tls_worker_index_;
+
+      // Current number of workers. Atomic so concurrent observers get a
+      // coherent value; mutations are additionally serialised by
+      // resize_mutex_ below.
+      std::atomic<size_t> thread_count_;
+      bool pin_threads_;
+
+      // Next CPU to pin a new worker to, when pinning is enabled. A
+      // persistent cursor (rather than the current vector size) keeps
+      // pins spread round-robin across shrink/grow cycles instead of
+      // re-stacking new workers onto the lowest cores. Guarded by
+      // mutex_ alongside threads_.
+      size_t next_cpu_;
+      std::vector<std::unique_ptr<ThreadRec>> threads_;
+
+      // Queue for tasks submitted from outside the pool, plus a semaphore
+      // counting the tasks queued anywhere in the pool. Workers block on
+      // the semaphore; once through it a task is guaranteed to exist in
+      // one of the queues.
+      MpmcRing<Task> global_tasks_;
+      char queue_pad_[kCacheLineSize];
+
+      // Fast lane for Priority::kHigh tasks; drained before everything
+      // else in TakeTask. Shares task_sem_ with the other queues, so a
+      // ticket still matches exactly one queued task.
+      MpmcRing<Task> urgent_tasks_;
+      char urgent_pad_[kCacheLineSize];
+      Semaphore task_sem_;
+      char sem_pad_[kCacheLineSize];
+
+      // Number of tasks submitted but not yet finished executing.
+      // WaitForTasks() blocks until it drops to 0.
+      std::atomic<size_t> pending_tasks_;
+      char pending_pad_[kCacheLineSize];
+
+      // Number of workers asked to exit but not yet exited. RemoveThreads
+      // bumps it once for the whole batch; each worker that claims a unit
+      // clears its own run flag and leaves. Tickets on task_sem_ cover
+      // tasks and shrink units alike.
+      std::atomic<size_t> shrink_pending_;
+      char shrink_pad_[kCacheLineSize];
+
+      // Pause gate: 0 while running, 1 while paused. Workers sample it
+      // with a single atomic load per task and futex-wait on it while the
+      // pool is paused; Resume() flips it back and wakes everyone.
+      std::atomic<int32_t> pause_gate_;
+      char gate_pad_[kCacheLineSize];
+
       std::mutex mutex_;
-      mutable bool is_paused_;
-      mutable Semaphore pause_sem_;
       std::condition_variable waiting_cv_;
 
+      // Serialises SetNumThreads calls: two concurrent resizes would
+      // otherwise both read the old thread count and fight over the
+      // same workers.
+      std::mutex resize_mutex_;
+
       static size_t DetermineThreadCount(size_t thread_count);
-      void CreateThreads(size_t thread_count);
-      void RemoveThreads(size_t thread_count);
-      void ServeTasks();
+
+      // Thread creation and removal only happen at construction,
+      // destruction and explicit resizes; keep them out of the hot text.
+      __attribute__((cold)) void CreateThreads(size_t thread_count);
+      __attribute__((cold)) void RemoveThreads(size_t thread_count);
+
+      void ServeTasks(ThreadRec* rec);
+      __attribute__((hot)) void EnqueueTask(Task task);
+      void EnqueueUrgentTask(Task task);
+      void EnqueueTaskBatch(std::vector<Task> tasks);
+      __attribute__((hot)) Task TakeTask(ThreadRec* rec);
+      bool TryStealTask(ThreadRec* self, Task& outparam);
+      void StealExtra(ThreadRec* self, ThreadRec* victim);
   };
 
   // --- implementation ---
@@ -121,13 +354,118 @@ namespace EK {
       // Shorthand for return type of calling task with args.
       using return_t = typename std::result_of<F(Args...)>::type;
 
-      // Wrapping the callable to be asynchronously invokable via std::packaged_task.
-      auto async_task = std::make_shared<std::packaged_task<return_t()>>(
-          std::bind(std::forward<F>(task), std::forward<Args>(args)...));
-      
-      // Enqueue async_task itself to be executed by the thread pool.
-      tasks_.Enqueue([async_task]{ (*async_task)(); });
-      
-      return async_task->get_future();
+      // Wrapping the callable to be asynchronously invokable via
+      // std::packaged_task. A move-capturing lambda avoids std::bind's
+      // extra allocation and type-erased dispatch, and lets the compiler
+      // inline the eventual call.
+      std::packaged_task<return_t()> async_task(
+          [task = std::forward<F>(task),
+           args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            return detail::Apply(std::move(task), std::move(args));
+          });
+      auto future = async_task.get_future();
+
+      // Move async_task into the enqueued Task: exactly one owner at any
+      // moment, so no shared_ptr control block or refcounting is needed.
+      EnqueueTask(Task(
+          [async_task = std::move(async_task)]() mutable { async_task(); }));
+
+      return future;
+    }
+
+  template <typename F, typename... Args>
+    auto ThreadPool::Submit(Priority priority, F&& task, Args&&... args) ->
+    std::future<typename std::result_of<F(Args...)>::type> {
+
+      using return_t = typename std::result_of<F(Args...)>::type;
+
+      std::packaged_task<return_t()> async_task(
+          [task = std::forward<F>(task),
+           args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            return detail::Apply(std::move(task), std::move(args));
+          });
+      auto future = async_task.get_future();
+
+      Task wrapped(
+          [async_task = std::move(async_task)]() mutable { async_task(); });
+      if (Priority::kHigh == priority) {
+        EnqueueUrgentTask(std::move(wrapped));
+      } else {
+        EnqueueTask(std::move(wrapped));
+      }
+
+      return future;
+    }
+
+  template <class InputIt>
+    void ThreadPool::SubmitBatch(InputIt first, InputIt last) {
+      std::vector<Task> batch;
+      for (; first != last; ++first) {
+        batch.emplace_back(Task(*first));
+      }
+      EnqueueTaskBatch(std::move(batch));
+    }
+
+  template <typename F>
+    void ThreadPool::SubmitN(size_t n, F&& task) {
+      std::vector<Task> batch;
+      batch.reserve(n);
+      for (size_t i = 0; i < n; ++i) {
+        batch.emplace_back(Task(task));
+      }
+      EnqueueTaskBatch(std::move(batch));
+    }
+
+  template <typename F>
+    void ThreadPool::ParallelFor(size_t begin, size_t end, F&& body) {
+      if (begin >= end) {
+        return;
+      }
+
+      size_t total = end - begin;
+      size_t workers = thread_count_.load(std::memory_order_acquire);
+      if (0 == workers) {
+        workers = 1;
+      }
+      size_t chunks = (total < workers) ? total : workers;
+      size_t chunk_size = (total + chunks - 1) / chunks;
+
+      // One chunk task per worker, published as a single batch. The
+      // completion semaphore lives on the heap, shared with every chunk:
+      // the final Acquire below can return while the last chunk is still
+      // inside Release (between its counter bump and its waiter check),
+      // so a stack-local semaphore could be destroyed under that Release.
+      // The reference to body stays valid because this function does not
+      // return until every chunk has released done.
+      auto done = std::make_shared<Semaphore>();
+      std::vector<Task> batch;
+      batch.reserve(chunks);
+      for (size_t c = 0; c < chunks; ++c) {
+        size_t lo = begin + (c * chunk_size);
+        size_t hi = lo + chunk_size;
+        if (hi > end) {
+          hi = end;
+        }
+        batch.emplace_back(Task([&body, done, lo, hi] {
+              for (size_t i = lo; i < hi; ++i) {
+                body(i);
+              }
+              done->Release();
+            }));
+      }
+      EnqueueTaskBatch(std::move(batch));
+
+      for (size_t c = 0; c < chunks; ++c) {
+        done->Acquire();
+      }
+    }
+
+  template <typename F, typename... Args>
+    void ThreadPool::SubmitDetached(F&& task, Args&&... args) {
+      EnqueueTask(Task(
+          [task = std::forward<F>(task),
+           args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            detail::Apply(std::move(task), std::move(args));
+          }));
     }
 } // end namespace EK
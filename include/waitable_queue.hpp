@@ -1,49 +1,110 @@
 /**
- * @file waitable_queue.hpp 
+ * @file waitable_queue.hpp
  * @author Eden Kellner
  * @date 29/04/2023
  *
- * @brief Thread-safe queue, allowing for multiple threads 
+ * @brief Thread-safe queue, allowing for multiple threads
  * to insert new items, remove existing items or wait until a new
  * item becomes available to consume.
+ *
+ * The queue is built from two pieces:
+ * 1. A bounded lock-free MPMC ring buffer (EK::MpmcRing) holding the items.
+ *    Producers and consumers claim slots with a single compare-and-swap,
+ *    so they no longer serialize on a mutex.
+ * 2. A semaphore (EK::Semaphore) counting the available items, used purely
+ *    as a sleep gate: consumers block on it when the queue drains.
  */
 
-#pragma once 
+#pragma once
+
+#include "mpmc_ring.hpp" // EK::MpmcRing, EK::detail::CpuRelax
+#include "semaphore.hpp" // EK::Semaphore
 
-#include <mutex>              // std::mutex, std::unique_lock
-#include <condition_variable> // std::condition_variable
-#include <chrono>             // std::chrono::milliseconds
-#include <queue>              // std::queue
+#include <chrono>        // std::chrono::milliseconds, std::chrono::steady_clock
+#include <utility>       // std::move
 
 namespace EK {
 
   /**
    * @brief Waitable, thread-safe queue class.
    *
-   * @tparam T is the value type which the container holds.
-   * @tparam Container is the container class used. Needs to support the 
-   * following methods: push(), pop(), front().
+   * @tparam T is the value type which the container holds. It must be
+   * default-constructible and move-assignable.
    */
-  template <class T, class Container = std::queue<T>>
+  template <class T>
   class WaitableQueue {
     public:
       /**
        * @brief Construct a waitable queue.
+       *
+       * @param capacity The minimum number of elements the queue can hold
+       * at once. When the queue is full, Enqueue() waits for a consumer
+       * to make room.
        */
-      WaitableQueue();
+      explicit WaitableQueue(size_t capacity = kDefaultCapacity);
 
       /**
        * @brief Inserts a new item into the queue.
        *
        * @param value - the item we wish to insert.
        */
-      void Enqueue(T value);
+      void Enqueue(const T& value);
+
+      /**
+       * @brief Inserts a new item into the queue by moving it,
+       * avoiding a copy for expensive-to-copy types.
+       *
+       * @param value - the item we wish to insert.
+       */
+      void Enqueue(T&& value);
+
+      /**
+       * @brief Constructs a new item directly from the given arguments
+       * and inserts it, with no intermediate copy.
+       *
+       * @param args - arguments forwarded to T's constructor.
+       */
+      template <class... Args>
+      void Emplace(Args&&... args);
+
+      /**
+       * @brief Attempts to insert a new item without ever waiting for
+       * room.
+       *
+       * @param value - the item we wish to insert. Only moved-from when
+       * the insertion succeeds.
+       *
+       * @return true if the item was inserted, false if the queue is full.
+       */
+      bool TryEnqueue(T&& value);
+
+      /**
+       * @brief Attempts to remove an item without ever blocking.
+       *
+       * @param outparam used to return the item acquired.
+       *
+       * @return true if an item was acquired, false if the queue is empty.
+       */
+      bool TryDequeue(T& outparam);
+
+      /**
+       * @brief Inserts a range of items into the queue in one call.
+       *
+       * All items are published before waiters are signalled, with a
+       * single semaphore release for the whole range instead of one
+       * wake-up per item.
+       *
+       * @tparam InputIt Iterator whose value type is convertible to T.
+       * @param first, last The range of items to insert.
+       */
+      template <class InputIt>
+      void EnqueueBatch(InputIt first, InputIt last);
 
       /**
        * @brief Removes an item from the queue.
        * The thread will be blocked, waiting until an item is available.
        *
-       * @return An item removed from the queue. 
+       * @return An item removed from the queue.
        */
 
       T Dequeue();
@@ -59,6 +120,47 @@ namespace EK {
        */
       bool Dequeue(std::chrono::milliseconds timeout, T& outparam);
 
+      /**
+       * @brief Removes an item from the queue, giving up at a point in
+       * time rather than after a duration.
+       *
+       * Prefer this over the duration overload when retrying against
+       * one overall deadline: the deadline does not restart with each
+       * call.
+       *
+       * @param deadline The point in time at which to give up waiting.
+       * @param outparam used to return the item acquired.
+       *
+       * @return True if an item has been acquired, and False otherwise.
+       */
+      bool Dequeue(std::chrono::steady_clock::time_point deadline,
+          T& outparam);
+
+      /**
+       * @brief Removes up to max items from the queue in one call,
+       * paying the blocking synchronisation cost only once.
+       *
+       * Blocks until at least one item is available, then opportunistically
+       * claims whatever else is already queued, up to max. Useful for
+       * consumers that can process items in bulk.
+       *
+       * @param out Array with room for at least max items.
+       * @param max The maximum number of items to remove.
+       *
+       * @return The number of items written to out, between 1 and max
+       * (0 only when max is 0).
+       */
+      size_t DequeueBatch(T* out, size_t max);
+
+      /**
+       * @brief Discard every item currently in the queue.
+       *
+       * Meant for resetting a queue between phases of use. Not atomic
+       * with respect to concurrent producers: items enqueued while
+       * Clear() runs may survive it.
+       */
+      void Clear();
+
       /**
        * @brief Get the number of elements currently in the queue.
        *
@@ -81,61 +183,174 @@ namespace EK {
       ~WaitableQueue() = default;
 
     private:
-      Container queue_;
-      mutable std::mutex mutex_;
-      std::condition_variable cv_;
-      size_t counter_;
+      static const size_t kDefaultCapacity = 1024;
+
+      // How long Dequeue spins for an item before going to sleep in the
+      // kernel. Under steady throughput the gap between a consumer
+      // finding the queue empty and the next producer's release is far
+      // shorter than a sleep/wake syscall pair, so a brief spin usually
+      // wins the item without blocking.
+      static const int kSpinIterations = 64;
+
+      MpmcRing<T> ring_;
+      mutable Semaphore items_;
     };
 
   // --- Implementation ---
-  template <class T, class Container>
-  WaitableQueue<T, Container>::WaitableQueue() :
-    queue_(), mutex_(), cv_(), counter_(0) {}
-  
-  template <class T, class Container>
-  void WaitableQueue<T, Container>::Enqueue(T value) {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    queue_.push(value);
-    ++counter_;
-    cv_.notify_one();
+  template <class T>
+  WaitableQueue<T>::WaitableQueue(size_t capacity) :
+    ring_(capacity), items_() {}
+
+  template <class T>
+  void WaitableQueue<T>::Enqueue(const T& value) {
+    Emplace(value);
+  }
+
+  template <class T>
+  void WaitableQueue<T>::Enqueue(T&& value) {
+    Emplace(std::move(value));
+  }
+
+  template <class T>
+  template <class... Args>
+  void WaitableQueue<T>::Emplace(Args&&... args) {
+    T value(std::forward<Args>(args)...);
+
+    // The ring only fails when it is full; back off until a consumer
+    // makes room, yielding once the wait outlives a brief spin so a
+    // producer stuck behind a slow consumer does not pin its core.
+    detail::Backoff backoff;
+    while (!ring_.TryEnqueue(std::move(value))) {
+      backoff.Wait();
+    }
+    items_.Release();
+  }
+
+  template <class T>
+  bool WaitableQueue<T>::TryEnqueue(T&& value) {
+    if (!ring_.TryEnqueue(std::move(value))) {
+      return false;
+    }
+    items_.Release();
+    return true;
+  }
+
+  template <class T>
+  bool WaitableQueue<T>::TryDequeue(T& outparam) {
+    // Claim an item through the semaphore first, so we never race a
+    // blocked consumer for the same element.
+    if (!items_.TryAcquire()) {
+      return false;
+    }
+
+    while (!ring_.TryDequeue(outparam)) {
+      detail::CpuRelax();
+    }
+    return true;
+  }
+
+  template <class T>
+  template <class InputIt>
+  void WaitableQueue<T>::EnqueueBatch(InputIt first, InputIt last) {
+    size_t count = 0;
+    detail::Backoff backoff;
+    for (; first != last; ++first) {
+      T value(*first);
+      while (!ring_.TryEnqueue(std::move(value))) {
+        backoff.Wait();
+      }
+      ++count;
+    }
+    items_.Release(count);
   }
 
-  template <class T, class Container>
-  T WaitableQueue<T, Container>::Dequeue() {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    cv_.wait(lock, [&]{ return counter_ > 0; });
-    --counter_;
-    
-    auto value = queue_.front();
-    queue_.pop();
+  template <class T>
+  T WaitableQueue<T>::Dequeue() {
+    // Optimistic bounded spin before blocking. Acquire() itself only
+    // enters the kernel when the counter is 0, so the spin purely covers
+    // the empty-but-about-to-be-filled window.
+    bool acquired = false;
+    for (int i = 0; i < kSpinIterations && !acquired; ++i) {
+      acquired = items_.TryAcquire();
+      if (!acquired) {
+        detail::CpuRelax();
+      }
+    }
+    if (!acquired) {
+      items_.Acquire();
+    }
+
+    // The semaphore guarantees an item exists, but its producer may not
+    // have finished publishing it yet; spin the short gap out.
+    T value;
+    while (!ring_.TryDequeue(value)) {
+      detail::CpuRelax();
+    }
     return value;
   }
 
-  template <class T, class Container>
-  bool WaitableQueue<T, Container>::Dequeue(std::chrono::milliseconds timeout,
+  template <class T>
+  bool WaitableQueue<T>::Dequeue(std::chrono::milliseconds timeout,
       T& outparam) {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    auto no_timeout = cv_.wait_for(lock, timeout, [&]{ return counter_ > 0; });
-
-    if (no_timeout) {
-      --counter_;
-      outparam = queue_.front();
-      queue_.pop();
-      return true;
-    } else {
+    if (!items_.TryAcquireFor(timeout)) {
       return false;
     }
+
+    while (!ring_.TryDequeue(outparam)) {
+      detail::CpuRelax();
+    }
+    return true;
+  }
+
+  template <class T>
+  bool WaitableQueue<T>::Dequeue(
+      std::chrono::steady_clock::time_point deadline, T& outparam) {
+    if (!items_.TryAcquireUntil(deadline)) {
+      return false;
+    }
+
+    while (!ring_.TryDequeue(outparam)) {
+      detail::CpuRelax();
+    }
+    return true;
+  }
+
+  template <class T>
+  size_t WaitableQueue<T>::DequeueBatch(T* out, size_t max) {
+    if (0 == max) {
+      return 0;
+    }
+
+    // Block for the first item, then claim the rest without sleeping:
+    // each successful TryAcquire is one more item we own.
+    items_.Acquire();
+    size_t taken = 1;
+    while (taken < max && items_.TryAcquire()) {
+      ++taken;
+    }
+
+    for (size_t i = 0; i < taken; ++i) {
+      while (!ring_.TryDequeue(out[i])) {
+        detail::CpuRelax();
+      }
+    }
+    return taken;
+  }
+
+  template <class T>
+  void WaitableQueue<T>::Clear() {
+    T discarded;
+    while (TryDequeue(discarded)) {
+    }
   }
 
-  template <class T, class Container>
-  bool WaitableQueue<T, Container>::IsEmpty() const {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    return (0 == counter_);
+  template <class T>
+  bool WaitableQueue<T>::IsEmpty() const {
+    return (0 == Size());
   }
 
-  template <class T, class Container>
-  size_t WaitableQueue<T, Container>::Size() const {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    return counter_;
+  template <class T>
+  size_t WaitableQueue<T>::Size() const {
+    return items_.GetCount();
   }
 } // end namespace EK
@@ -1,42 +1,112 @@
 #include "semaphore.hpp" // EK::Semaphore
-#include <mutex>
+#include "futex.hpp"     // EK::detail::FutexWait, EK::detail::FutexWake
+
+#include <cerrno>        // errno, ETIMEDOUT
 
 namespace EK {
   Semaphore::Semaphore(size_t initial_count) :
-    mutex_(), cv_(), counter_(initial_count) {}
+    counter_(static_cast<int32_t>(initial_count)), waiters_(0) {}
 
   void Semaphore::Release() {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    ++counter_;
-    cv_.notify_one();
+    counter_.fetch_add(1, std::memory_order_seq_cst);
+
+    // Only enter the kernel when a thread is actually asleep. The
+    // sequentially consistent counter increment above and waiter
+    // registration in Acquire() guarantee that either we observe the
+    // waiter here, or the waiter's futex call observes the new counter
+    // and returns immediately.
+    if (0 != waiters_.load(std::memory_order_seq_cst)) {
+      detail::FutexWake(&counter_, 1);
+    }
   }
 
   void Semaphore::Release(size_t n) {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    counter_ += n;
-    cv_.notify_all();
+    counter_.fetch_add(static_cast<int32_t>(n), std::memory_order_seq_cst);
+
+    // A single futex call wakes up to n waiters, instead of
+    // issuing one wake-up per increment.
+    if (0 != waiters_.load(std::memory_order_seq_cst)) {
+      detail::FutexWake(&counter_, static_cast<int32_t>(n));
+    }
   }
 
   void Semaphore::Acquire() {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    cv_.wait(lock, [&]{ return counter_ > 0; });
-    --counter_;
+    for (;;) {
+      // Fast path: claim a unit with a CAS while the counter is positive.
+      int32_t count = counter_.load(std::memory_order_relaxed);
+      while (count > 0) {
+        if (counter_.compare_exchange_weak(count, count - 1,
+              std::memory_order_acquire, std::memory_order_relaxed)) {
+          return;
+        }
+      }
+
+      // Slow path: register as a waiter, then sleep until the counter
+      // moves away from 0 and retry. FutexWait returns immediately if
+      // the counter is no longer 0.
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+      detail::FutexWait(&counter_, 0);
+      waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool Semaphore::TryAcquire() {
+    // Same CAS fast path as Acquire(), minus the slow path: a counter
+    // at 0 means immediate failure instead of sleeping.
+    int32_t count = counter_.load(std::memory_order_relaxed);
+    while (count > 0) {
+      if (counter_.compare_exchange_weak(count, count - 1,
+            std::memory_order_acquire, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
   }
 
   bool Semaphore::TryAcquireFor(std::chrono::milliseconds timeout) {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    bool no_timeout = cv_.wait_for(lock, timeout, [&] { return counter_ > 0; });
-
-    if (no_timeout) {
-      --counter_;
-      return true;
-    } else {
-      return false;
+    return TryAcquireUntil(std::chrono::steady_clock::now() + timeout);
+  }
+
+  bool Semaphore::TryAcquireUntil(
+      std::chrono::steady_clock::time_point deadline_tp) {
+    // Convert the deadline once, as an absolute time on the clock the
+    // kernel checks: on Linux, steady_clock is CLOCK_MONOTONIC, which
+    // is the clock FUTEX_WAIT_BITSET measures against. Each retry
+    // after a wake-up then re-arms the same deadline in a single timed
+    // futex wait, instead of measuring the remaining time in userspace
+    // and restarting a relative wait.
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        deadline_tp.time_since_epoch()).count();
+    struct timespec deadline = {
+      static_cast<time_t>(nanos / 1000000000),
+      static_cast<long>(nanos % 1000000000)
+    };
+
+    for (;;) {
+      int32_t count = counter_.load(std::memory_order_relaxed);
+      while (count > 0) {
+        if (counter_.compare_exchange_weak(count, count - 1,
+              std::memory_order_acquire, std::memory_order_relaxed)) {
+          return true;
+        }
+      }
+
+      // Wait until woken, until the counter changes, or until the
+      // deadline passes. Spurious wake-ups are handled by the
+      // surrounding loop, which re-checks the counter.
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+      long waited = detail::FutexWaitUntil(&counter_, 0, &deadline);
+      waiters_.fetch_sub(1, std::memory_order_relaxed);
+
+      if (-1 == waited && ETIMEDOUT == errno) {
+        // The deadline passed. One final claim attempt covers a
+        // release that raced the timeout.
+        return TryAcquire();
+      }
     }
   }
 
   size_t Semaphore::GetCount() {
-    std::unique_lock<decltype(mutex_)> lock(mutex_);
-    return counter_;
+    return static_cast<size_t>(counter_.load(std::memory_order_acquire));
   }
 } // end namespace EK
@@ -1,15 +1,35 @@
 #include "thread_pool.hpp" // EK::ThreadPool
-#include <cmath>           // std::abs
+#include "futex.hpp"       // EK::detail::FutexWait, EK::detail::FutexWake
+
+#include <pthread.h>       // pthread_setaffinity_np
+#include <sched.h>         // cpu_set_t, CPU_ZERO, CPU_SET
 
 namespace EK {
+  namespace {
+    // hardware_concurrency() may probe the system on every call; sample it
+    // once at static-init time since the answer never changes.
+    const size_t kHwThreads = std::thread::hardware_concurrency();
+
+    // Source of worker ordinals, across all pools in the process.
+    std::atomic<size_t> next_worker_ordinal(0);
+  } // end anonymous namespace
+
+  thread_local ThreadPool* ThreadPool::tls_pool_ = nullptr;
+  thread_local ThreadPool::ThreadRec* ThreadPool::tls_rec_ = nullptr;
+  thread_local size_t ThreadPool::tls_worker_index_ =
+    static_cast<size_t>(-1);
+
   /**-----------------*
    * PUBLIC FUNCTIONS *
    *------------------*/
-  
-  ThreadPool::ThreadPool(size_t thread_count) :
+
+  ThreadPool::ThreadPool(size_t thread_count, bool pin_threads) :
     thread_count_(ThreadPool::DetermineThreadCount(thread_count)),
-    threads_(), should_run_(), tasks_(), joinable_threads_(), mutex_(),
-    is_paused_(false), pause_sem_(), waiting_cv_() {
+    pin_threads_(pin_threads),
+    next_cpu_(0), threads_(), global_tasks_(kGlobalQueueCapacity),
+    urgent_tasks_(kUrgentQueueCapacity), task_sem_(),
+    pending_tasks_(0), shrink_pending_(0), pause_gate_(0),
+    mutex_(), waiting_cv_() {
     CreateThreads(thread_count_);
   }
 
@@ -19,35 +39,32 @@ namespace EK {
   }
 
   void ThreadPool::SetNumThreads(std::size_t num_threads) {
-    size_t diff = std::abs(static_cast<long long>(num_threads - thread_count_));
-    if (num_threads > thread_count_) {
-      CreateThreads(diff);
+    std::lock_guard<std::mutex> resize_lock(resize_mutex_);
+
+    size_t current = thread_count_.load(std::memory_order_relaxed);
+    if (num_threads > current) {
+      CreateThreads(num_threads - current);
     } else {
-      RemoveThreads(diff);
+      RemoveThreads(current - num_threads);
     }
-    thread_count_ = num_threads;
+    thread_count_.store(num_threads, std::memory_order_relaxed);
   }
 
   void ThreadPool::Pause() {
-    if (is_paused_) {
-      return;
-    }
-
-    for (size_t i = 0; i < thread_count_; ++i) {
-      Submit([this] {
-          pause_sem_.Acquire();
-        });
-    }
-    is_paused_ = true;
+    // The CAS makes repeated pauses harmless: only the 0 -> 1 transition
+    // takes effect. Workers observe the gate before executing their next
+    // task, so tasks already running are not interrupted.
+    int32_t expected = 0;
+    pause_gate_.compare_exchange_strong(expected, 1,
+        std::memory_order_acq_rel);
   }
 
   void ThreadPool::Resume() {
-    if (!is_paused_) {
-      return;
+    int32_t expected = 1;
+    if (pause_gate_.compare_exchange_strong(expected, 0,
+          std::memory_order_acq_rel)) {
+      detail::FutexWake(&pause_gate_, INT32_MAX);
     }
-
-    pause_sem_.Release(thread_count_);
-    is_paused_ = false;
   }
 
   /**------------------*
@@ -55,9 +72,21 @@ namespace EK {
    *-------------------*/
 
   void ThreadPool::CreateThreads(size_t thread_count) {
+    std::unique_lock<decltype(mutex_)> lock(mutex_);
     for (size_t i = 0; i < thread_count; ++i) {
-      auto new_thread = std::thread(&ThreadPool::ServeTasks, this);
-      threads_.emplace(new_thread.get_id(), std::move(new_thread));
+      threads_.emplace_back(std::unique_ptr<ThreadRec>(new ThreadRec()));
+      auto rec = threads_.back().get();
+      rec->thread = std::thread(&ThreadPool::ServeTasks, this, rec);
+
+      if (pin_threads_ && 0 != kHwThreads) {
+        // Best effort: a failed affinity call just leaves the worker
+        // schedulable anywhere, which is the unpinned behaviour anyway.
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(next_cpu_++ % kHwThreads, &cpuset);
+        pthread_setaffinity_np(rec->thread.native_handle(),
+            sizeof(cpuset), &cpuset);
+      }
     }
   }
 
@@ -69,49 +98,247 @@ namespace EK {
 
     // Default: total number of hardware threads available.
     // If unable to detect, return 1.
-    thread_count = std::thread::hardware_concurrency();
-    return thread_count ? thread_count : 1;
+    return kHwThreads ? kHwThreads : 1;
   }
 
   void ThreadPool::RemoveThreads(size_t thread_count) {
-    // Each threads receives a task to terminate itself.
-    for (size_t i = 0; i < thread_count; ++i) {
-      Submit([this] { 
-            std::unique_lock<decltype(mutex_)> lock(mutex_);
-            should_run_[std::this_thread::get_id()] = false;
-          });
+    // A single atomic broadcast replaces one poison task per worker:
+    // publish the number of workers that should leave, then release that
+    // many tickets so sleeping workers wake up to claim them.
+    shrink_pending_.fetch_add(thread_count, std::memory_order_release);
+    task_sem_.Release(thread_count);
+
+    // Reap workers whose run flag has been cleared, until thread_count
+    // of them have been joined.
+    size_t joined = 0;
+    while (joined < thread_count) {
+      std::unique_ptr<ThreadRec> victim;
+      {
+        std::unique_lock<decltype(mutex_)> lock(mutex_);
+        for (auto it = threads_.begin(); it != threads_.end(); ++it) {
+          if (!(*it)->should_run.load(std::memory_order_acquire)) {
+            victim = std::move(*it);
+            threads_.erase(it);
+            break;
+          }
+        }
+      }
+
+      if (victim) {
+        victim->thread.join();
+        ++joined;
+      } else {
+        std::this_thread::yield();
+      }
     }
+  }
+
+  size_t ThreadPool::WorkerIndex() {
+    return tls_worker_index_;
+  }
+
+  void ThreadPool::ServeTasks(ThreadRec* rec) {
+    tls_pool_ = this;
+    tls_rec_ = rec;
+    tls_worker_index_ = next_worker_ordinal.fetch_add(1,
+        std::memory_order_relaxed);
+
+    while (rec->should_run.load(std::memory_order_acquire)) {
+      // Spin briefly for a ticket before parking, mirroring the bounded
+      // spin in WaitableQueue::Dequeue: under a burst of short tasks the
+      // next ticket usually arrives within the spin window, and winning
+      // it here skips a park/unpark round trip through the kernel.
+      bool acquired = false;
+      for (int i = 0; i < kIdleSpinIterations && !acquired; ++i) {
+        acquired = task_sem_.TryAcquire();
+        if (!acquired) {
+          detail::CpuRelax();
+        }
+      }
+      if (!acquired) {
+        task_sem_.Acquire();
+      }
+
+      // Hold off while the pool is paused. The task we hold a claim on
+      // stays queued until we resume.
+      while (1 == pause_gate_.load(std::memory_order_acquire)) {
+        detail::FutexWait(&pause_gate_, 1);
+      }
+
+      // The ticket we hold covers either a queued task or a shrink unit.
+      // Claim a shrink unit first if one is pending: clear our own run
+      // flag and leave; the reaper in RemoveThreads joins us.
+      size_t shrink = shrink_pending_.load(std::memory_order_acquire);
+      bool leaving = false;
+      while (shrink > 0 && !leaving) {
+        leaving = shrink_pending_.compare_exchange_weak(shrink, shrink - 1,
+            std::memory_order_acq_rel);
+      }
+      if (leaving) {
+        // Requeue whatever is left in our local queue before leaving:
+        // the reaper destroys this ThreadRec, and tasks destroyed with
+        // the ring would leave their tickets and pending counts
+        // outstanding, wedging TakeTask and WaitForTasks forever. The
+        // tickets for these tasks were already released, so moving the
+        // tasks keeps the accounting balanced. Nobody enqueues into
+        // another worker's queue, so the ring stays drained once we
+        // are done.
+        Task orphan;
+        detail::Backoff backoff;
+        while (rec->local_tasks.TryDequeue(orphan)) {
+          while (!global_tasks_.TryEnqueue(std::move(orphan))) {
+            backoff.Wait();
+          }
+        }
+
+        rec->should_run.store(false, std::memory_order_release);
+        break;
+      }
+
+      auto task = TakeTask(rec);
+      task();
 
-    // Join back threads that terminated.
-    for (size_t i = 0; i < thread_count; ++i) { 
-      auto id = joinable_threads_.Dequeue();
-      auto terminated_thread = std::move(threads_[id]);
-      threads_.erase(id);
-      if (terminated_thread.joinable()) {
-        terminated_thread.join();
+      // If this was the last outstanding task, let waiters know. The
+      // empty critical section pairs with the one in WaitForTasks, so
+      // a waiter cannot miss the notification.
+      if (1 == pending_tasks_.fetch_sub(1, std::memory_order_acq_rel)) {
+        {
+          std::unique_lock<decltype(mutex_)> lock(mutex_);
+        }
+        waiting_cv_.notify_all();
       }
     }
+
+    tls_pool_ = nullptr;
+    tls_rec_ = nullptr;
+    tls_worker_index_ = static_cast<size_t>(-1);
   }
 
-  void ThreadPool::ServeTasks() {
-    auto id = std::this_thread::get_id();
-    {
-      std::unique_lock<decltype(mutex_)> lock(mutex_);
-      should_run_[id] = true;
+  void ThreadPool::EnqueueTask(Task task) {
+    pending_tasks_.fetch_add(1, std::memory_order_relaxed);
+
+    // Fast path for tasks submitted from inside a worker of this very
+    // pool: push to the submitting worker's own queue, skipping the
+    // contended global ring. Siblings can still steal it from there.
+    if (this == tls_pool_) {
+      if (tls_rec_->local_tasks.TryEnqueue(std::move(task))) {
+        task_sem_.Release();
+        return;
+      }
+      // Local queue full; fall through to the global one. TryEnqueue
+      // leaves the task intact when it fails.
     }
 
-    while (should_run_[id]) {
-      auto task = tasks_.Dequeue();
-      waiting_cv_.notify_one();
-      task();
+    // The global queue only rejects when full; back off until a worker
+    // makes room. Yielding after a short spin keeps a submitter stuck
+    // behind a full ring (or a paused pool) from pinning its core.
+    detail::Backoff backoff;
+    while (!global_tasks_.TryEnqueue(std::move(task))) {
+      backoff.Wait();
+    }
+    task_sem_.Release();
+  }
+
+  void ThreadPool::EnqueueUrgentTask(Task task) {
+    pending_tasks_.fetch_add(1, std::memory_order_relaxed);
+
+    detail::Backoff backoff;
+    while (!urgent_tasks_.TryEnqueue(std::move(task))) {
+      backoff.Wait();
+    }
+    task_sem_.Release();
+  }
+
+  void ThreadPool::EnqueueTaskBatch(std::vector<Task> tasks) {
+    pending_tasks_.fetch_add(tasks.size(), std::memory_order_relaxed);
+
+    detail::Backoff backoff;
+    for (auto& task : tasks) {
+      while (!global_tasks_.TryEnqueue(std::move(task))) {
+        backoff.Wait();
+      }
+    }
+
+    // One release covers the whole batch: a single counter bump and at
+    // most one futex wake instead of one per task.
+    task_sem_.Release(tasks.size());
+  }
+
+  Task ThreadPool::TakeTask(ThreadRec* rec) {
+    // The caller passed task_sem_, so a task is guaranteed to exist.
+    // Prefer our own queue, then the global one, and steal from a sibling
+    // as a last resort. The spin only runs in the short window between a
+    // producer releasing the semaphore and publishing its task.
+    Task task;
+    for (;;) {
+      if (urgent_tasks_.TryDequeue(task)) {
+        return task;
+      }
+      if (rec->local_tasks.TryDequeue(task)) {
+        return task;
+      }
+      if (global_tasks_.TryDequeue(task)) {
+        return task;
+      }
+      if (TryStealTask(rec, task)) {
+        return task;
+      }
+      detail::CpuRelax();
+    }
+  }
+
+  bool ThreadPool::TryStealTask(ThreadRec* self, Task& outparam) {
+    // The lock protects the vector's shape, not the queues themselves:
+    // the rings are safe to pop concurrently.
+    std::unique_lock<decltype(mutex_)> lock(mutex_);
+    size_t count = threads_.size();
+    if (0 == count) {
+      return false;
+    }
+
+    // Start the scan at a random sibling so simultaneous thieves spread
+    // across victims instead of all hammering the first queue.
+    size_t x = self->rng_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self->rng_state = x;
+
+    for (size_t i = 0; i < count; ++i) {
+      auto& rec = threads_[(x + i) % count];
+      if (rec.get() != self && rec->local_tasks.TryDequeue(outparam)) {
+        StealExtra(self, rec.get());
+        return true;
+      }
     }
+    return false;
+  }
 
-    joinable_threads_.Enqueue(id);
+  void ThreadPool::StealExtra(ThreadRec* self, ThreadRec* victim) {
+    // Steal-half: besides the task just taken, move up to half of what
+    // remains in the victim's queue over to our own, so the thief's next
+    // few iterations hit its local queue instead of making another
+    // cross-queue trip. Tasks only change queues here, so the ticket
+    // count stays balanced and siblings can still steal them onwards.
+    size_t extra = victim->local_tasks.ApproxSize() / 2;
+    Task task;
+    while (extra-- > 0 && victim->local_tasks.TryDequeue(task)) {
+      if (!self->local_tasks.TryEnqueue(std::move(task))) {
+        // Our queue is full; park the task in the global ring instead.
+        detail::Backoff backoff;
+        while (!global_tasks_.TryEnqueue(std::move(task))) {
+          backoff.Wait();
+        }
+        break;
+      }
+    }
   }
 
   void ThreadPool::WaitForTasks() {
     Resume();
     std::unique_lock<decltype(mutex_)> lock(mutex_);
-    waiting_cv_.wait(lock, [this] { return tasks_.IsEmpty(); });
+    waiting_cv_.wait(lock, [this] {
+        return 0 == pending_tasks_.load(std::memory_order_acquire);
+      });
   }
 } // end namespace EK
@@ -2,6 +2,7 @@
 #include "thread_pool.hpp" // EK::ThreadPool
 
 #include <array>           // std::array
+#include <atomic>          // std::atomic
 #include <chrono>          // std::chrono::milliseconds, std::chrono::seconds
 #include <cstdlib>         // EXIT_FAILURE, EXIT_SUCCESS
 #include <future>          // std::future_status
@@ -9,21 +10,23 @@
 #include <mutex>           // std::mutex, std::unique_lock
 #include <string>          // std::string
 #include <thread>          // std::this_thread::sleep_for
-#include <set>             // std::set
 
 static int SmokeTest();
 static int BasicUsageTest();
 static int WaitForTasksTest();
+static int ParallelForTest();
 static int PerfectForwardingTest();
 static int PauseAndResumeTest();
 static int MultiPauseAndMultiResumeTest();
 static int SetNumThreadsTest();
+static int ShrinkRequeuesLocalTasksTest();
+static int PriorityLaneTest();
 
 static int CheckPerfectForwarding(std::string&& s);
 static int CheckPerfectForwarding(const std::string& s);
-static int ReturnArg(int i);
+static constexpr int ReturnArg(int i);
 template <typename T>
-static T Sum(T i, T j);
+static constexpr T Sum(T i, T j);
 
 // Runner
 int main() {
@@ -32,10 +35,13 @@ int main() {
   status += SmokeTest();
   status += BasicUsageTest();
   status += WaitForTasksTest();
+  status += ParallelForTest();
   status += PerfectForwardingTest();
   status += MultiPauseAndMultiResumeTest();
   status += PauseAndResumeTest();
   status += SetNumThreadsTest();
+  status += ShrinkRequeuesLocalTasksTest();
+  status += PriorityLaneTest();
 
   if (0 == status) {
     std::cerr << "SUCCESS: Thread Pool" << std::endl;
@@ -67,9 +73,12 @@ static int BasicUsageTest() {
   // Send lambda with return value
   auto res1 = tp.Submit([](int x, int y) { return x + y; }, 1, 1);
 
-  if (2 != res1.get()) {
+  // get() is one-shot: read it into a local once, then test and report
+  // from that. A second get() on the same future throws future_error.
+  auto val1 = res1.get();
+  if (2 != val1) {
     std::cerr << "ERROR: BasicUsageTest" << std::endl;
-    std::cerr << "Expected to get 2, but instead got " << res1.get() << std::endl;
+    std::cerr << "Expected to get 2, but instead got " << val1 << std::endl;
     status += EXIT_FAILURE;
   }
 
@@ -90,24 +99,27 @@ static int BasicUsageTest() {
   int j = 1;
   auto res3 = tp.Submit([](int i, int j) { return Sum(i, j); }, i, j);
 
-  if (2 != res3.get()) {
+  auto val3 = res3.get();
+  if (2 != val3) {
     std::cerr << "ERROR: BasicUsageTest" << std::endl;
-    std::cerr << "Expected answer to be 2, but instead it is " << res3.get() << std::endl;
+    std::cerr << "Expected answer to be 2, but instead it is " << val3 << std::endl;
     status += EXIT_FAILURE;
   }
 
   auto res4 = tp.Submit([]() { return Sum(1, 1); });
-  if (2 != res4.get()) {
+  auto val4 = res4.get();
+  if (2 != val4) {
     std::cerr << "ERROR: BasicUsageTest" << std::endl;
-    std::cerr << "Expected answer to be 2, but instead it is " << res4.get() << std::endl;
+    std::cerr << "Expected answer to be 2, but instead it is " << val4 << std::endl;
     status += EXIT_FAILURE;
   }
 
-  // Sumbit a function 
+  // Sumbit a function
   auto res5 = tp.Submit(ReturnArg, 0);
-  if(0 != res5.get()) {
+  auto val5 = res5.get();
+  if(0 != val5) {
     std::cerr << "ERROR: BasicUsageTest" << std::endl;
-    std::cerr << "Expected function to return 0, but instead got " << res5.get() << std::endl;
+    std::cerr << "Expected function to return 0, but instead got " << val5 << std::endl;
     status += EXIT_FAILURE;
   }
 
@@ -166,16 +178,20 @@ static int BasicUsageTest() {
 static int WaitForTasksTest() {
   // Run 500 tasks. Make sure all tasks got executed before
   // the dtor was called.
-  size_t num = 0;
+  // Each worker bumps its own shard so tasks do not serialize on one
+  // mutex; the shards are summed once the pool is gone.
+  std::array<std::atomic<size_t>, 64> shards = {};
   {
-    std::mutex mutex;
     EK::ThreadPool tp;
-    for (int i = 0; i < 500; ++i) {
-      tp.Submit([&mutex, &num] { 
-          std::unique_lock<std::mutex> lock (mutex);
-          ++num;
-          });
-    }
+    tp.SubmitN(500, [&shards] {
+        shards[EK::ThreadPool::WorkerIndex() % shards.size()].fetch_add(
+            1, std::memory_order_relaxed);
+        });
+  }
+
+  size_t num = 0;
+  for (const auto& shard : shards) {
+    num += shard.load();
   }
 
   if (500 != num) {
@@ -189,7 +205,48 @@ static int WaitForTasksTest() {
 }
 
 /**
- * @brief Making sure that Submit() has perfect forwarding, meaning that the 
+ * @brief Testing ParallelFor():
+ * 1. Every index in the range is visited exactly once (the sum of all
+ *    visited indices matches the closed-form total).
+ * 2. An empty range is a no-op.
+ *
+ * @return 0 upon success, 1 upon failure.
+ */
+static int ParallelForTest() {
+  EK::ThreadPool tp;
+  const size_t n = 1000;
+
+  std::atomic<size_t> sum(0);
+  tp.ParallelFor(0, n, [&sum](size_t i) {
+      sum.fetch_add(i, std::memory_order_relaxed);
+      });
+
+  size_t expected = (n * (n - 1)) / 2;
+  if (expected != sum.load()) {
+    std::cerr << "ERROR: ParallelForTest" << std::endl;
+    std::cerr << "Expected sum to be " << expected << ", instead got "
+      << sum.load() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Empty range: body must never run.
+  std::atomic<size_t> calls(0);
+  tp.ParallelFor(5, 5, [&calls](size_t) {
+      calls.fetch_add(1, std::memory_order_relaxed);
+      });
+
+  if (0 != calls.load()) {
+    std::cerr << "ERROR: ParallelForTest" << std::endl;
+    std::cerr << "Expected no calls for an empty range, instead got "
+      << calls.load() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Making sure that Submit() has perfect forwarding, meaning that the
  * type category (l-value or r-value) of arguments passed to it is unaltered.
  *
  * @return 0 upon success, 1 upon failure.
@@ -264,31 +321,63 @@ static int PauseAndResumeTest() {
   const size_t thread_count = 2;
   EK::ThreadPool tp(thread_count);
 
+  // Instead of time-slicing with sleeps, the tasks synchronize with the
+  // main thread through semaphores: started_ reports a task is running,
+  // gate_ holds it there until the main thread decides, and done_
+  // reports the count was bumped. This makes the expected counts exact,
+  // with no dependence on scheduling speed.
   class CountFunctor {
   public:
-    CountFunctor() : counter_(0) {}
+    CountFunctor() : counter_(0), gate_(nullptr), started_(nullptr),
+      done_(nullptr) {}
+
+    void Init(EK::Semaphore* gate, EK::Semaphore* started,
+        EK::Semaphore* done) {
+      gate_ = gate;
+      started_ = started;
+      done_ = done;
+    }
+
     void operator()() {
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+      started_->Release();
+      gate_->Acquire();
       ++counter_;
+      done_->Release();
     }
+
     int GetCounter() const {
       return counter_;
     }
 
   private:
     int counter_;
+    EK::Semaphore* gate_;
+    EK::Semaphore* started_;
+    EK::Semaphore* done_;
   };
 
   // Inserting tasks_num tasks.
+  EK::Semaphore gate;
+  EK::Semaphore started;
+  EK::Semaphore done;
   std::array<CountFunctor, tasks_num> tasks_arr;
   for (auto &t : tasks_arr) {
-    tp.Submit(std::ref(t));
+    t.Init(&gate, &started, &done);
+    tp.SubmitDetached(std::ref(t));
   }
 
-  // Sleep such that exactly thread_count tasks could have been acquired by threads,
-  // pause and check that no additional tasks are being performed.
-  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  // Wait until exactly thread_count tasks are running, pause, then let
+  // just those tasks finish. Paused workers must not pick up any of the
+  // remaining tasks.
+  for (size_t i = 0; i < thread_count; ++i) {
+    started.Acquire();
+  }
   tp.Pause();
+  gate.Release(thread_count);
+  for (size_t i = 0; i < thread_count; ++i) {
+    done.Acquire();
+  }
+
   size_t actual_count = 0;
   for (const auto &t : tasks_arr) {
     actual_count += t.GetCounter();
@@ -297,13 +386,15 @@ static int PauseAndResumeTest() {
 
   if (expected_count != actual_count) {
     std::cerr << "ERROR! PauseAndResumeTest" << std::endl;
-    std::cerr << "After pausing, expected " << expected_count 
+    std::cerr << "After pausing, expected " << expected_count
       << " tasks to be performed, but " << actual_count << " were." << std::endl;
     status += EXIT_FAILURE;
   }
 
-  // Resume, make sure that all tasks got carried out.
+  // Resume, open the gate for the rest and make sure that all tasks got
+  // carried out.
   tp.Resume();
+  gate.Release(tasks_num - thread_count);
   tp.WaitForTasks();
   expected_count = tasks_num;
   actual_count = 0;
@@ -312,8 +403,8 @@ static int PauseAndResumeTest() {
   }
 
   if (expected_count != actual_count) {
-    std::cerr << "ERROR! PauseAndReactual_counteTest" << std::endl;
-    std::cerr << "After resuming, expected " << expected_count 
+    std::cerr << "ERROR! PauseAndResumeTest" << std::endl;
+    std::cerr << "After resuming, expected " << expected_count
       << " tasks to be performed, but " << actual_count << " were." << std::endl;
     status += EXIT_FAILURE;
   }
@@ -343,7 +434,6 @@ static int PauseAndResumeTest() {
  */
 static int SetNumThreadsTest() {
   EK::ThreadPool tp;
-  std::mutex mutex;
   std::mutex total_mutex;
   std::condition_variable total_cv;
   std::array<size_t, 3> test_cases = {2, 1, 3};
@@ -351,25 +441,53 @@ static int SetNumThreadsTest() {
   for (auto thread_count : test_cases) {
     EK::Semaphore sem;
     size_t tasks_num = 2 * thread_count;
-    size_t total_count = 0;
-    std::set<std::thread::id> thread_ids;
+    std::atomic<size_t> total_count(0);
+
+    // Lock-free insert-if-absent registry of worker ids: a slot is
+    // either a default-constructed id (empty) or a registered thread.
+    // A handful of slots is plenty for the counts tested here.
+    std::array<std::atomic<std::thread::id>, 16> id_slots = {};
+    std::atomic<size_t> unique_ids(0);
+    auto register_thread_id = [&id_slots, &unique_ids] {
+          auto me = std::this_thread::get_id();
+          for (auto& slot : id_slots) {
+            if (slot.load(std::memory_order_acquire) == me) {
+              return;
+            }
+            std::thread::id empty;
+            if (slot.compare_exchange_strong(empty, me,
+                  std::memory_order_acq_rel)) {
+              unique_ids.fetch_add(1, std::memory_order_relaxed);
+              return;
+            }
+            // Lost the claim race; the winner may have been us on
+            // another task, so re-check before probing onwards.
+            if (slot.load(std::memory_order_acquire) == me) {
+              return;
+            }
+          }
+        };
 
     tp.SetNumThreads(thread_count);
-    // Insert tasks to register id to the thread_ids set.
-    auto register_id_task = [&total_count, &mutex, &total_cv, &sem, &thread_ids] {
-          // Register id.
-          {
-            std::unique_lock<decltype(mutex)> lock(mutex);
-            thread_ids.insert(std::this_thread::get_id());
-            ++total_count;
+    // Insert tasks to register the executing thread's id.
+    auto register_id_task =
+      [&total_count, &total_cv, &sem, &register_thread_id, thread_count] {
+          // Register id, then count the task with a lock-free increment
+          // so workers never serialise on a mutex here. Only increments
+          // that could satisfy the main thread's predicate bother to
+          // notify, so there is at most one wakeup per test case plus
+          // one per straggler.
+          register_thread_id();
+          if (total_count.fetch_add(1, std::memory_order_release) + 1
+              >= thread_count) {
+            total_cv.notify_one();
           }
-          total_cv.notify_one();        
 
           // Wait for main thread to unblock.
           sem.Acquire();
         };
     for (size_t i = 0; i < tasks_num; ++i) {
-      tp.Submit(register_id_task);
+      tp.SubmitDetached(register_id_task);
     }
 
     // Main thread wait until thread_count different thread have performed tasks.
@@ -377,14 +495,16 @@ static int SetNumThreadsTest() {
     std::unique_lock<decltype(total_mutex)> lock(total_mutex);
     total_cv.wait_for(lock,
         std::chrono::seconds(1),
-        [&thread_count, &total_count] { return thread_count == total_count; });
+        [&thread_count, &total_count] {
+          return total_count.load(std::memory_order_acquire) >= thread_count;
+        });
     sem.Release(tasks_num);
     tp.WaitForTasks();
 
-    if (thread_count != thread_ids.size()) {
+    if (thread_count != unique_ids.load()) {
       std::cerr << "ERROR: SetNumThreadsTest" << std::endl;
       std::cerr << "Expected " << thread_count << " threads, but instead there's "
-        << thread_ids.size() << " threads in the thread pool." << std::endl;
+        << unique_ids.load() << " threads in the thread pool." << std::endl;
       return EXIT_FAILURE;
     }
   }
@@ -392,14 +512,116 @@ static int SetNumThreadsTest() {
   return EXIT_SUCCESS;
 }
 
+/**
+ * @brief Regression test: shrinking the pool must not strand tasks
+ * sitting in a departing worker's local queue.
+ *
+ * A task submitted from inside a worker lands in that worker's own
+ * queue; if the worker then claims a shrink unit, the queued task has
+ * to be requeued onto the global queue before the worker's record is
+ * destroyed, or the task (and its accounting) is lost and the pool
+ * wedges. Without the requeue this test hangs in done.Acquire().
+ *
+ * @return 0 upon success, 1 upon failure.
+ */
+static int ShrinkRequeuesLocalTasksTest() {
+  EK::Semaphore done;
+  std::atomic<size_t> count(0);
+  {
+    EK::ThreadPool tp(1);
+
+    // The outer task runs on the only worker, so the inner task goes
+    // through the submit-from-worker fast path into its local queue.
+    tp.SubmitDetached([&tp, &done, &count] {
+        tp.SubmitDetached([&done, &count] {
+            count.fetch_add(1, std::memory_order_relaxed);
+            done.Release();
+          });
+      });
+
+    tp.SetNumThreads(0);
+    tp.SetNumThreads(1);
+    done.Acquire();
+  }
+
+  if (1 != count.load()) {
+    std::cerr << "ERROR: ShrinkRequeuesLocalTasksTest" << std::endl;
+    std::cerr << "Expected the requeued task to run once, but it ran "
+      << count.load() << " times" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Testing that a Priority::kHigh task overtakes queued normal
+ * tasks.
+ *
+ * The pool's single worker is held inside a gated task while a backlog
+ * of normal tasks and then one urgent task are queued behind it. Once
+ * the gate opens, the worker must drain the urgent lane first, so the
+ * urgent task has to observe none of the normal backlog as executed.
+ *
+ * @return 0 upon success, 1 upon failure.
+ */
+static int PriorityLaneTest() {
+  const size_t backlog = 4;
+  EK::ThreadPool tp(1);
+  EK::Semaphore gate;
+  EK::Semaphore started;
+  std::atomic<size_t> normal_done(0);
+
+  // Occupy the only worker so everything below stays queued.
+  tp.SubmitDetached([&gate, &started] {
+      started.Release();
+      gate.Acquire();
+    });
+  started.Acquire();
+
+  // Queue the normal backlog first, then the urgent task behind it.
+  for (size_t i = 0; i < backlog; ++i) {
+    tp.SubmitDetached([&normal_done] {
+        normal_done.fetch_add(1, std::memory_order_relaxed);
+      });
+  }
+  auto overtaken = tp.Submit(EK::Priority::kHigh, [&normal_done] {
+      return normal_done.load(std::memory_order_relaxed);
+    });
+
+  gate.Release();
+  size_t done_before_urgent = overtaken.get();
+  tp.WaitForTasks();
+
+  if (0 != done_before_urgent) {
+    std::cerr << "ERROR: PriorityLaneTest" << std::endl;
+    std::cerr << "Expected the urgent task to run before the backlog, "
+      << "but " << done_before_urgent << " normal tasks ran first"
+      << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (backlog != normal_done.load()) {
+    std::cerr << "ERROR: PriorityLaneTest" << std::endl;
+    std::cerr << "Expected all " << backlog << " normal tasks to run, "
+      << "but only " << normal_done.load() << " did" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
 // Utilities
 
+// constexpr so calls from inside task lambdas fold down to a single
+// add/mov: the tests then measure the pool's overhead, not the
+// callable's.
 template <typename T>
-static T Sum(T i, T j) {
+static constexpr T Sum(T i, T j) {
   return i + j;
 }
 
-static int ReturnArg(int i) {
+static constexpr int ReturnArg(int i) {
   return i;
 }
 
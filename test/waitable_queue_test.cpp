@@ -1,32 +1,46 @@
+#include "semaphore.hpp"      // EK::Semaphore
+#include "thread_pool.hpp"    // EK::ThreadPool
 #include "waitable_queue.hpp" // EK::WaitableQueue
 
+#include <atomic>             // std::atomic
+#include <cstdarg>            // va_list, va_start, va_end
+#include <cstdio>             // vsnprintf, fwrite, fputc, stderr
 #include <cstdlib>            // EXIT_FAILURE, EXIT_SUCCESS
+#include <future>             // std::future
 #include <iostream>           // std::cerr, std::endl
+#include <string>             // std::string
 #include <thread>             // std::thread
 #include <vector>             // std::vector
 
-static int SmokeTest();
-static int FailedTimeoutDequeue();
-static int SuccessfulTimeoutDequeue();
+static int RunSmallTests();
+static int FailedTimeoutDequeue(EK::WaitableQueue<int>& waitable_queue);
+static int SuccessfulTimeoutDequeue(EK::WaitableQueue<int>& waitable_queue);
 static int OneProducerMultipleConsumers(int n);
+static int BatchTest(int n);
+static int MoveEnqueueTest();
 static int EmptyTest();
 static int SizeTest();
+static int TryOperationsTest();
 
 template<typename T>
 static void Producer(EK::WaitableQueue<T> &waitable_queue, int n);
 template<typename T>
-static void Consumer(EK::WaitableQueue<T> &waitable_queue, std::mutex& mutex, int& sum);
+static void Consumer(EK::WaitableQueue<T> &waitable_queue, std::atomic<int>& sum);
+
+__attribute__((format(printf, 1, 2)))
+static void Fail(const char* fmt, ...);
 
 // Runner
 int main() {
   int status = 0;
   
-  status += SmokeTest();
-  status += FailedTimeoutDequeue();
-  status += SuccessfulTimeoutDequeue();
+  status += RunSmallTests();
   status += OneProducerMultipleConsumers(5);
+  status += BatchTest(100);
+  status += MoveEnqueueTest();
   status += EmptyTest();
   status += SizeTest();
+  status += TryOperationsTest();
 
   if (EXIT_SUCCESS == status) {
     std::cerr << "SUCCESS: WaitableQueue" << std::endl;
@@ -35,32 +49,52 @@ int main() {
 }
 
 // Tests
-static int SmokeTest() {
-  // Smoke test: if things don't crash and burn we're happy.
+static int RunSmallTests() {
+  // One queue serves all the small single-threaded checks, reset with
+  // Clear() between phases: constructing it doubles as the smoke test,
+  // and the later phases no longer each pay a fresh ring allocation.
   EK::WaitableQueue<int> waitable_queue;
-  return EXIT_SUCCESS;
+  int status = 0;
+
+  status += FailedTimeoutDequeue(waitable_queue);
+  waitable_queue.Clear();
+  status += SuccessfulTimeoutDequeue(waitable_queue);
+  waitable_queue.Clear();
+
+  // Clear() itself: whatever the phases left behind plus a few more
+  // items must all be gone afterwards.
+  waitable_queue.Enqueue(1);
+  waitable_queue.Enqueue(2);
+  waitable_queue.Clear();
+  if (true != waitable_queue.IsEmpty()) {
+    Fail("FAILED: RunSmallTests\n"
+        "Expected the queue to be empty after Clear().");
+    ++status;
+  }
+
+  return status;
 }
 
 static int EmptyTest() {
   int status = 0;
   EK::WaitableQueue<int> waitable_queue;
   if (true != waitable_queue.IsEmpty()) {
-    std::cout << "ERROR: EmptyTest" << std::endl;
-    std::cout << "IsEmpty() for newly created waitable queue retuned false!" << std::endl;
+    Fail("ERROR: EmptyTest\n"
+        "IsEmpty() for newly created waitable queue retuned false!");
     status += EXIT_FAILURE;
   }
 
   waitable_queue.Enqueue(1);
   if (false != waitable_queue.IsEmpty()) {
-    std::cout << "ERROR: EmptyTest" << std::endl;
-    std::cout << "IsEmpty() for queue with 1 element retuned true!" << std::endl;
+    Fail("ERROR: EmptyTest\n"
+        "IsEmpty() for queue with 1 element retuned true!");
     status += EXIT_FAILURE;
   }
 
   waitable_queue.Dequeue();
   if (true != waitable_queue.IsEmpty()) {
-    std::cout << "ERROR: EmptyTest" << std::endl;
-    std::cout << "IsEmpty() for queue that's been emptied retuned false!" << std::endl;
+    Fail("ERROR: EmptyTest\n"
+        "IsEmpty() for queue that's been emptied retuned false!");
     status += EXIT_FAILURE;
   }
 
@@ -71,48 +105,109 @@ static int SizeTest() {
   int status = 0;
   EK::WaitableQueue<int> waitable_queue;
   if (0 != waitable_queue.Size()) {
-    std::cout << "ERROR: SizeTest" << std::endl;
-    std::cout << "Size() for newly created waitable queue retuned " 
-      << waitable_queue.Size() << std::endl;
+    Fail("ERROR: SizeTest\n"
+        "Size() for newly created waitable queue retuned %zu",
+        waitable_queue.Size());
     status += EXIT_FAILURE;
   }
 
   waitable_queue.Enqueue(1);
   if (1 != waitable_queue.Size()) {
-    std::cout << "ERROR: SizeTest" << std::endl;
-    std::cout << "Size() for queue with 1 element retuned " << waitable_queue.Size() << std::endl;
+    Fail("ERROR: SizeTest\n"
+        "Size() for queue with 1 element retuned %zu",
+        waitable_queue.Size());
     status += EXIT_FAILURE;
   }
 
   waitable_queue.Dequeue();
   if (0 != waitable_queue.Size()) {
-    std::cout << "ERROR: SizeTest" << std::endl;
-    std::cout << "Size() for queue that's been emptied retuned " 
-      << waitable_queue.Size() << std::endl;
+    Fail("ERROR: SizeTest\n"
+        "Size() for queue that's been emptied retuned %zu",
+        waitable_queue.Size());
+    status += EXIT_FAILURE;
+  }
+
+  return status;
+}
+
+static int TryOperationsTest() {
+  int status = 0;
+
+  // Capacity 2 is also the ring's minimum, so the third insertion is
+  // guaranteed to find the queue full.
+  EK::WaitableQueue<std::string> waitable_queue(2);
+
+  std::string out;
+  if (false != waitable_queue.TryDequeue(out)) {
+    Fail("ERROR: TryOperationsTest\n"
+        "TryDequeue() on an empty queue returned true!");
+    status += EXIT_FAILURE;
+  }
+
+  if (true != waitable_queue.TryEnqueue("first") ||
+      true != waitable_queue.TryEnqueue("second")) {
+    Fail("ERROR: TryOperationsTest\n"
+        "TryEnqueue() failed with room to spare!");
+    status += EXIT_FAILURE;
+  }
+
+  // A full queue must reject the item and leave it untouched, per the
+  // only-moved-from-on-success contract.
+  std::string rejected = "third";
+  if (false != waitable_queue.TryEnqueue(std::move(rejected))) {
+    Fail("ERROR: TryOperationsTest\n"
+        "TryEnqueue() on a full queue returned true!");
+    status += EXIT_FAILURE;
+  }
+  if ("third" != rejected) {
+    Fail("ERROR: TryOperationsTest\n"
+        "TryEnqueue() moved from the item despite failing!");
+    status += EXIT_FAILURE;
+  }
+
+  if (true != waitable_queue.TryDequeue(out) || "first" != out ||
+      true != waitable_queue.TryDequeue(out) || "second" != out) {
+    Fail("ERROR: TryOperationsTest\n"
+        "TryDequeue() did not return the enqueued items in order!");
+    status += EXIT_FAILURE;
+  }
+
+  if (false != waitable_queue.TryDequeue(out)) {
+    Fail("ERROR: TryOperationsTest\n"
+        "TryDequeue() on a drained queue returned true!");
     status += EXIT_FAILURE;
   }
 
   return status;
 }
-static int FailedTimeoutDequeue() {
+
+static int FailedTimeoutDequeue(EK::WaitableQueue<int>& waitable_queue) {
   // Attempting to deque from the waitable queue and failing.
-  EK::WaitableQueue<int> waitable_queue;
   int res = 0;
   int status = (false != 
       waitable_queue.Dequeue(std::chrono::milliseconds(1), res));
 
   if (status) {
-    std::cerr << "FAILED: FailedTimeoutDequeue" << std::endl;
-    std::cerr << "Expected Dequeue(timeout, outparam) to return false," << 
-      " but true was returned instead." << std::endl;
-  } 
+    Fail("FAILED: FailedTimeoutDequeue\n"
+        "Expected Dequeue(timeout, outparam) to return false,"
+        " but true was returned instead.");
+  }
+
+  // Same check through the absolute-deadline overload.
+  if (false != waitable_queue.Dequeue(
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(1),
+        res)) {
+    Fail("FAILED: FailedTimeoutDequeue\n"
+        "Expected Dequeue(deadline, outparam) to return false,"
+        " but true was returned instead.");
+    ++status;
+  }
 
   return status;
 }
 
-static int SuccessfulTimeoutDequeue() {
+static int SuccessfulTimeoutDequeue(EK::WaitableQueue<int>& waitable_queue) {
   // Attempting to deque from the waitable queue and succeeding.
-  EK::WaitableQueue<int> waitable_queue;
   int res = 0;
 
   waitable_queue.Enqueue(1234);
@@ -120,15 +215,29 @@ static int SuccessfulTimeoutDequeue() {
       waitable_queue.Dequeue(std::chrono::milliseconds(1), res));
 
   if (status) {
-    std::cerr << "FAILED: SuccessfulTimeoutDequeue" << std::endl;
-    std::cerr << "Expected Dequeue(timeout, outparam) to return true," << 
-      " but false was returned instead." << std::endl;
-  } 
+    Fail("FAILED: SuccessfulTimeoutDequeue\n"
+        "Expected Dequeue(timeout, outparam) to return true,"
+        " but false was returned instead.");
+  }
 
   if (1234 != res) {
-    std::cerr << "FAILED: SuccessfulTimeoutDequeue" << std::endl;
-    std::cerr << "Expected outparam to be equal 1234, but instead it is "
-      << res << std::endl;
+    Fail("FAILED: SuccessfulTimeoutDequeue\n"
+        "Expected outparam to be equal 1234, but instead it is %d", res);
+    ++status;
+  }
+
+  // Same check through the absolute-deadline overload.
+  waitable_queue.Enqueue(4321);
+  if (true != waitable_queue.Dequeue(
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(1),
+        res)) {
+    Fail("FAILED: SuccessfulTimeoutDequeue\n"
+        "Expected Dequeue(deadline, outparam) to return true,"
+        " but false was returned instead.");
+    ++status;
+  } else if (4321 != res) {
+    Fail("FAILED: SuccessfulTimeoutDequeue\n"
+        "Expected outparam to be equal 4321, but instead it is %d", res);
     ++status;
   }
 
@@ -136,39 +245,192 @@ static int SuccessfulTimeoutDequeue() {
 }
 
 static int OneProducerMultipleConsumers(int n) {
-  // One producer, multiple consumers scenrio.
-  std::vector<std::thread> threads;
+  // One producer, multiple consumers scenrio. The consumers and the
+  // producer run as tasks on the project's own thread pool instead of
+  // freshly cloned std::threads, so the test pays thread creation once
+  // and measures the queue rather than pthread_create. The pool holds
+  // n + 1 workers: every consumer may block in Dequeue while the
+  // producer still needs a worker to run on. Pinning spreads the
+  // workers round-robin over the allowed CPUs, so the queue's hot
+  // cache lines ping-pong between stable cores instead of following
+  // scheduler migrations.
+  EK::ThreadPool pool(n + 1, true);
+  std::vector<std::future<void>> futures;
+  futures.reserve(n + 1);
 
-  // Create consumers & producer
-  EK::WaitableQueue<int> waitable_queue;
-  std::mutex mutex;
-  int sum = 0;
+  // Keep the shared accumulator on its own cache line: it sits on the
+  // stack between the queue and the futures vector, and without the
+  // padding every consumer's fetch_add would invalidate the line its
+  // neighbours' reads live on. Pad members rather than alignas, as
+  // elsewhere in this tree.
+  struct PaddedSum {
+    char pad0[64];
+    std::atomic<int> value;
+    char pad1[64];
+  };
+
+  // The ring preallocates all backing storage at construction; size it
+  // for the test so nothing is oversized and nothing allocates later.
+  EK::WaitableQueue<int> waitable_queue(n);
+  PaddedSum sum = {};
+
+  // Start barrier: each task reports ready and blocks on go, and the
+  // main thread opens the gate only once all n + 1 are waiting. The
+  // producer and consumers then race from the same instant, instead
+  // of the producer running before some consumers have even started.
+  EK::Semaphore ready;
+  EK::Semaphore go;
   for (int i = 0; i < n; ++i) {
-    threads.emplace_back(std::thread(Consumer<int>, 
-        std::ref(waitable_queue), std::ref(mutex), std::ref(sum)));
+    futures.emplace_back(pool.Submit([&waitable_queue, &sum, &ready, &go] {
+          ready.Release();
+          go.Acquire();
+          Consumer<int>(waitable_queue, sum.value);
+        }));
   }
 
-  threads.emplace_back(std::thread(Producer<int>, std::ref(waitable_queue), n));
+  futures.emplace_back(pool.Submit([&waitable_queue, &ready, &go, n] {
+        ready.Release();
+        go.Acquire();
+        Producer<int>(waitable_queue, n);
+      }));
 
-  // Join threads and check that sum is as expected.
-  for (auto& t: threads) {
-    if (t.joinable()) {
-      t.join();
-    }
+  for (int i = 0; i < n + 1; ++i) {
+    ready.Acquire();
+  }
+  go.Release(n + 1);
+
+  // Wait for every task and check that sum is as expected.
+  for (auto& f : futures) {
+    f.wait();
   }
 
   int expected_sum = (n * (n - 1)) / 2;
-  if (sum != expected_sum) {
-    std::cerr << "FAILED: OneProducerMultipleConsumers " << std::endl;
-    std::cerr << "Expected sum to be " << expected_sum <<
-      " but instead got " << sum << std::endl;
+  if (sum.value.load(std::memory_order_acquire) != expected_sum) {
+    Fail("FAILED: OneProducerMultipleConsumers\n"
+        "Expected sum to be %d but instead got %d",
+        expected_sum, sum.value.load());
     return EXIT_FAILURE;
   }
 
   return EXIT_SUCCESS;
 }
 
+static int BatchTest(int n) {
+  // Publish all n values with one EnqueueBatch, drain them with
+  // concurrent DequeueBatch consumers that sum each batch locally and
+  // publish it with a single fetch_add - one synchronisation per
+  // batch on both sides instead of one per item.
+  EK::WaitableQueue<int> waitable_queue(n);
+  std::atomic<int> sum(0);
+  std::atomic<int> taken(0);
+
+  std::vector<int> values;
+  values.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    values.push_back(i);
+  }
+  waitable_queue.EnqueueBatch(values.begin(), values.end());
+
+  // Consumers claim a slice of the item count up front, then dequeue
+  // exactly that many. Claiming first means nobody ever blocks on an
+  // item another consumer already took.
+  auto drain = [&waitable_queue, &sum, &taken, n] {
+        int buf[16];
+        for (;;) {
+          int claimed = taken.fetch_add(16, std::memory_order_relaxed);
+          if (claimed >= n) {
+            return;
+          }
+          int remaining = (n - claimed < 16) ? (n - claimed) : 16;
+
+          int local = 0;
+          while (remaining > 0) {
+            size_t got = waitable_queue.DequeueBatch(buf,
+                static_cast<size_t>(remaining));
+            for (size_t i = 0; i < got; ++i) {
+              local += buf[i];
+            }
+            remaining -= static_cast<int>(got);
+          }
+          sum.fetch_add(local, std::memory_order_relaxed);
+        }
+      };
+
+  const int consumers = 3;
+  std::vector<std::thread> threads;
+  threads.reserve(consumers);
+  for (int i = 0; i < consumers; ++i) {
+    threads.emplace_back(drain);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  int expected_sum = (n * (n - 1)) / 2;
+  if (sum.load() != expected_sum) {
+    Fail("FAILED: BatchTest\n"
+        "Expected sum to be %d but instead got %d",
+        expected_sum, sum.load());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int MoveEnqueueTest() {
+  // The int tests never tell copies and moves apart; run a non-trivial
+  // type through the move overload and Emplace to check both avoid
+  // copying.
+  int status = 0;
+  EK::WaitableQueue<std::string> waitable_queue;
+
+  std::string payload(64, 'x');
+  const char* data_before = payload.data();
+  waitable_queue.Enqueue(std::move(payload));
+
+  std::string out = waitable_queue.Dequeue();
+  if (data_before != out.data()) {
+    Fail("FAILED: MoveEnqueueTest\n"
+        "Expected the enqueued string's buffer to be moved"
+        " through the queue, but it was reallocated.");
+    ++status;
+  }
+
+  waitable_queue.Emplace(64, 'y');
+  out = waitable_queue.Dequeue();
+  if (std::string(64, 'y') != out) {
+    Fail("FAILED: MoveEnqueueTest\n"
+        "Expected an emplaced string of 64 'y's, but got \"%s\"",
+        out.c_str());
+    ++status;
+  }
+
+  return status;
+}
+
 // Utilities
+
+// Failure diagnostics: format the whole message into one buffer and
+// emit it with a single fwrite plus newline, so a failure firing in
+// the middle of a concurrent phase costs one stream operation rather
+// than a string of locking operator<< calls and flushes.
+static void Fail(const char* fmt, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+
+  if (len < 0) {
+    return;
+  }
+  if (len > static_cast<int>(sizeof(buf)) - 1) {
+    len = static_cast<int>(sizeof(buf)) - 1;
+  }
+  fwrite(buf, 1, static_cast<size_t>(len), stderr);
+  fputc('\n', stderr);
+}
+
 template<typename T>
 static void Producer(EK::WaitableQueue<T> &waitable_queue, int n) {
   // Produce values [0..n]
@@ -179,10 +441,9 @@ static void Producer(EK::WaitableQueue<T> &waitable_queue, int n) {
 
 template<typename T>
 static void Consumer(EK::WaitableQueue<T> &waitable_queue,
-    std::mutex& mutex,
-    int& sum) {
-  // Consume data from the waitable queue, and add it to sum.
-  int value = waitable_queue.Dequeue();
-  std::lock_guard<std::mutex> lock(mutex);
-  sum += value;
+    std::atomic<int>& sum) {
+  // Consume data from the waitable queue, and add it to sum. A single
+  // relaxed fetch_add replaces the mutex round trip the accumulation
+  // used to pay; joining the threads orders the final read.
+  sum.fetch_add(waitable_queue.Dequeue(), std::memory_order_relaxed);
 }